@@ -0,0 +1,235 @@
+#ifndef CAST_MAILBOX_H_
+#define CAST_MAILBOX_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "Message.h"
+#include "util/MPSCQueue.h"
+#include "util/Noncopyable.h"
+#include "util/Thread.h"
+
+namespace mcast {
+
+// what SendMessage does when the mailbox of the destination is full
+enum class MailboxOverflowPolicy {
+  kFailFast,    // returns kAgain
+  kBlock,       // blocks the sending service until there is space, other
+                // senders(io, timer, user threads) get kAgain
+  kDropOldest,  // drops the oldest message, its closure gets kAgain
+};
+
+// Mailbox is the message queue of a service. Any thread may Push without
+// taking a lock, the owner service is the single consumer.
+//
+// The mailbox is "scheduled" from the push that makes it non-empty until the
+// consumer finds it empty again, only that push has to wake up the consumer.
+class Mailbox : public Noncopyable {
+ public:
+  static constexpr uint64_t kUnbounded = std::numeric_limits<uint64_t>::max();
+
+  enum PushResult {
+    kRejected,   // the mailbox is closed
+    kFull,       // the mailbox is full
+    kQueued,     // the consumer is already scheduled
+    kScheduled,  // the caller has to wake up the consumer
+  };
+
+  Mailbox() = default;
+
+  ~Mailbox() {
+    MessagePtr msg;
+    while (Pop(&msg)) {
+    }
+  }
+
+  // must be called before any Push, 0 means unbounded
+  void SetCapacity(uint64_t capacity, MailboxOverflowPolicy policy) {
+    capacity_ = capacity > 0 ? capacity : kUnbounded;
+    policy_ = policy;
+  }
+
+  uint64_t capacity() const {
+    return capacity_;
+  }
+
+  MailboxOverflowPolicy overflow_policy() const {
+    return policy_;
+  }
+
+  // with kDropOldest a full mailbox evicts its oldest message into *evicted
+  // instead of returning kFull, the depth may then exceed the capacity by the
+  // number of concurrent senders
+  PushResult Push(const MessagePtr& msg, MessagePtr* evicted = nullptr) {
+    uint64_t s = state_.fetch_add(kOneSender + kOneMessage, std::memory_order_acquire);
+    if (s & kClosedBit) {
+      state_.fetch_sub(kOneSender + kOneMessage, std::memory_order_relaxed);
+      return kRejected;
+    }
+
+    uint64_t const depth = Messages(s) + 1;
+    if (depth > capacity_) {
+      if (policy_ != MailboxOverflowPolicy::kDropOldest) {
+        state_.fetch_sub(kOneSender + kOneMessage, std::memory_order_relaxed);
+        return kFull;
+      }
+
+      assert(evicted);
+      if (PopLocked(evicted))
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    } else if (depth > high_watermark_.load(std::memory_order_relaxed)) {
+      UpdateHighWatermark(depth);
+    }
+
+    queue_.Push(new Node(msg));
+
+    // leaves and schedules in one step, the release pairs with Unschedule
+    s = state_.load(std::memory_order_relaxed);
+    while (!state_.compare_exchange_weak(s, (s - kOneSender) | kScheduledBit,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_relaxed)) {
+    }
+
+    return (s & (kScheduledBit | kClosedBit)) ? kQueued : kScheduled;
+  }
+
+  // consumer side
+
+  bool Pop(MessagePtr* msg) {
+    if (policy_ == MailboxOverflowPolicy::kDropOldest)
+      return PopLocked(msg);
+
+    return PopBatchUnlocked(msg, 1) > 0;
+  }
+
+  // pops up to max messages at once and appends them to out, returns the
+  // number popped
+  size_t PopBatch(std::vector<MessagePtr>* out, size_t max) {
+    size_t const old_size = out->size();
+    out->resize(old_size + max);
+    size_t n;
+    if (policy_ == MailboxOverflowPolicy::kDropOldest) {
+      // senders evict from the same end
+      std::lock_guard<std::mutex> gl(pop_mutex_);
+      n = PopBatchUnlocked(out->data() + old_size, max);
+    } else {
+      n = PopBatchUnlocked(out->data() + old_size, max);
+    }
+    out->resize(old_size + n);
+    return n;
+  }
+
+  // called after Pop failed, returns true if the consumer may wait for a
+  // kMessage event, false if messages arrived meanwhile and the consumer is
+  // still scheduled
+  bool Unschedule() {
+    state_.fetch_and(~kScheduledBit, std::memory_order_acq_rel);
+    if (queue_.Empty())
+      return true;
+
+    return state_.fetch_or(kScheduledBit, std::memory_order_acq_rel) & kScheduledBit;
+  }
+
+  // rejects further pushes, returns once the pushes in progress are done so
+  // the consumer can drain every accepted message
+  void Close() {
+    uint64_t s = state_.fetch_or(kClosedBit, std::memory_order_acq_rel);
+    while (Senders(s) != 0) {
+      this_thread::Yield();
+      s = state_.load(std::memory_order_acquire);
+    }
+  }
+
+  bool Empty() const {
+    return queue_.Empty();
+  }
+
+  bool Full() const {
+    return Size() >= capacity_;
+  }
+
+  // messages pushed and not yet popped
+  uint64_t Size() const {
+    return Messages(state_.load(std::memory_order_seq_cst));
+  }
+
+  uint64_t HighWatermark() const {
+    return high_watermark_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t Dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Node {
+    Node() = default;
+    explicit Node(const MessagePtr& m) : msg(m) {}
+
+    std::atomic<Node*> next{nullptr};
+    MessagePtr msg;
+  };
+
+  // state_: messages(42 bits) | senders(20 bits) | closed | scheduled
+  static constexpr uint64_t kScheduledBit = 1;
+  static constexpr uint64_t kClosedBit = 2;
+  static constexpr int kSenderShift = 2;
+  static constexpr int kMessageShift = 22;
+  static constexpr uint64_t kOneSender = 1ULL << kSenderShift;
+  static constexpr uint64_t kOneMessage = 1ULL << kMessageShift;
+
+  static uint64_t Senders(uint64_t s) {
+    return (s & (kOneMessage - 1)) >> kSenderShift;
+  }
+
+  static uint64_t Messages(uint64_t s) {
+    return s >> kMessageShift;
+  }
+
+  bool PopLocked(MessagePtr* msg) {
+    std::lock_guard<std::mutex> gl(pop_mutex_);
+    return PopBatchUnlocked(msg, 1) > 0;
+  }
+
+  size_t PopBatchUnlocked(MessagePtr* out, size_t max) {
+    size_t n = 0;
+    for (; n < max; ++n) {
+      Node* const node = queue_.Pop();
+      if (nullptr == node)
+        break;
+
+      out[n] = std::move(node->msg);
+      delete node;
+    }
+
+    // seq_cst: a sender blocked on a full mailbox registers itself and then
+    // checks Size, the consumer frees space and then checks for waiters
+    if (n > 0)
+      state_.fetch_sub(n * kOneMessage, std::memory_order_seq_cst);
+    return n;
+  }
+
+  void UpdateHighWatermark(uint64_t depth) {
+    uint64_t hw = high_watermark_.load(std::memory_order_relaxed);
+    while (depth > hw && !high_watermark_.compare_exchange_weak(
+                             hw, depth, std::memory_order_relaxed)) {
+    }
+  }
+
+  std::atomic<uint64_t> state_{0};
+  concurrence::waitfree::IntrusiveMPSCQueue<Node> queue_;
+
+  uint64_t capacity_ = kUnbounded;
+  MailboxOverflowPolicy policy_ = MailboxOverflowPolicy::kFailFast;
+  std::atomic<uint64_t> high_watermark_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::mutex pop_mutex_;  // only used by kDropOldest
+};
+
+}  // namespace mcast
+
+#endif  // CAST_MAILBOX_H_
@@ -0,0 +1,104 @@
+#include "Mailbox.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "util/Test.h"
+
+using namespace mcast;
+
+namespace {
+
+MessagePtr MakeStringMessage(const std::string& text) {
+  return std::make_shared<StringMessage>(ServiceHandle(), ServiceHandle(),
+                                         Message::Closure(), text);
+}
+
+}  // namespace
+
+TEST(MailboxTest, ScheduleTestCase) {
+  Mailbox mailbox;
+  ASSERT_TRUE(mailbox.Empty());
+
+  // only the push which makes an idle mailbox non-empty wakes the consumer
+  ASSERT_EQ(mailbox.Push(MakeStringMessage("1")), Mailbox::kScheduled);
+  ASSERT_EQ(mailbox.Push(MakeStringMessage("2")), Mailbox::kQueued);
+  ASSERT_EQ(mailbox.Size(), 2U);
+
+  MessagePtr msg;
+  ASSERT_TRUE(mailbox.Pop(&msg));
+  ASSERT_EQ(dynamic_cast<StringMessage*>(msg.get())->get_msg(), "1");
+  ASSERT_TRUE(mailbox.Pop(&msg));
+  ASSERT_EQ(dynamic_cast<StringMessage*>(msg.get())->get_msg(), "2");
+  ASSERT_FALSE(mailbox.Pop(&msg));
+  ASSERT_EQ(mailbox.Size(), 0U);
+
+  ASSERT_TRUE(mailbox.Unschedule());
+  ASSERT_EQ(mailbox.Push(MakeStringMessage("3")), Mailbox::kScheduled);
+
+  mailbox.Close();
+  ASSERT_EQ(mailbox.Push(MakeStringMessage("4")), Mailbox::kRejected);
+  ASSERT_TRUE(mailbox.Pop(&msg));
+  ASSERT_EQ(dynamic_cast<StringMessage*>(msg.get())->get_msg(), "3");
+  ASSERT_TRUE(mailbox.Empty());
+}
+
+TEST(MailboxTest, PopBatchTestCase) {
+  Mailbox mailbox;
+  for (int i = 0; i < 10; ++i) {
+    mailbox.Push(MakeStringMessage(std::to_string(i)));
+  }
+
+  std::vector<MessagePtr> batch;
+  ASSERT_EQ(mailbox.PopBatch(&batch, 4), 4U);
+  ASSERT_EQ(mailbox.Size(), 6U);
+  ASSERT_EQ(mailbox.PopBatch(&batch, 100), 6U);
+  ASSERT_EQ(mailbox.PopBatch(&batch, 100), 0U);
+  ASSERT_EQ(mailbox.Size(), 0U);
+  ASSERT_EQ(batch.size(), 10U);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    ASSERT_EQ(dynamic_cast<StringMessage*>(batch[i].get())->get_msg(), std::to_string(i));
+  }
+}
+
+TEST(MailboxTest, ManyProducersTestCase) {
+  Mailbox mailbox;
+  const int producers = 4;
+  const int messages = 10000;
+  std::atomic<int> wakeups{0};
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&mailbox, &wakeups] {
+      for (int i = 0; i < messages; ++i) {
+        if (mailbox.Push(MakeStringMessage("x")) == Mailbox::kScheduled)
+          ++wakeups;
+      }
+    });
+  }
+
+  // like a service, the consumer waits for a wake up whenever Unschedule
+  // tells it to, a lost wake up hangs the test
+  int received = 0;
+  int waits = 0;
+  MessagePtr msg;
+  while (received < producers * messages) {
+    if (mailbox.Pop(&msg)) {
+      ++received;
+    } else if (mailbox.Unschedule()) {
+      while (wakeups.load() == waits) {
+        std::this_thread::yield();
+      }
+      ++waits;
+    }
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  ASSERT_EQ(received, producers * messages);
+  ASSERT_TRUE(mailbox.Empty());
+  ASSERT_LE(wakeups.load() - waits, 1);
+}
@@ -38,11 +38,20 @@ class Message : Noncopyable {
 
   virtual ~Message() {}
 
+  // an error is kept for the synchronous callers, see status()
   void Done(const Status& s) {
+    if (!s)
+      status_ = s;
     if (closure_)
       closure_(s);
   }
 
+  // the error the message was done with, OK if none. Done(OK) does not write
+  // it, so a caller woken before the handler returns may read it
+  const Status& status() const {
+    return status_;
+  }
+
   void SetClosure(const Closure& c) {
     closure_ = c;
   }
@@ -61,6 +70,7 @@ class Message : Noncopyable {
   Handle source_;
   Handle destination_;
   Closure closure_;
+  Status status_;
 };
 
 typedef std::shared_ptr<Message> MessagePtr;
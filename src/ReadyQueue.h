@@ -0,0 +1,170 @@
+#ifndef CAST_READYQUEUE_H_
+#define CAST_READYQUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "util/Noncopyable.h"
+#include "util/util_config.h"
+
+namespace mcast {
+
+enum class ServicePriority { kHigh = 0, kNormal, kLow };
+
+constexpr int kServicePriorityCount = 3;
+
+// ReadyQueue keeps one FIFO per priority and pops them in weighted round
+// robin. Each round every priority has a credit of its weight, pop takes the
+// highest non-empty priority with credit left and a new round starts when no
+// queued priority has credit. While every level is busy a round pops
+// kHighWeight high, kNormalWeight normal and kLowWeight low priority
+// elements, so a lower priority is slowed down but never starved, and a newly
+// queued high priority element waits for at most one round of the others.
+template <typename T>
+class alignas(kCacheLineSize) ReadyQueue : Noncopyable {
+ public:
+  typedef typename std::deque<T>::size_type size_type;
+
+  static constexpr unsigned kHighWeight = 16;
+  static constexpr unsigned kNormalWeight = 4;
+  static constexpr unsigned kLowWeight = 1;
+
+  ReadyQueue() = default;
+
+  void push(T&& x, ServicePriority priority) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    PushLocked(std::move(x), priority);
+  }
+
+  // pushes unless the queue is closed, x is left untouched then. used by
+  // other threads than the owner, which may be retiring.
+  bool try_push(T&& x, ServicePriority priority) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    if (closed_)
+      return false;
+
+    PushLocked(std::move(x), priority);
+    return true;
+  }
+
+  // makes try_push fail, push still works
+  void close() {
+    std::lock_guard<std::mutex> lg(mutex_);
+    closed_ = true;
+  }
+
+  void open() {
+    std::lock_guard<std::mutex> lg(mutex_);
+    closed_ = false;
+  }
+
+  bool pop(T* x) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    if (size_ == 0)
+      return false;
+
+    int level = 0;
+    while (levels_[level].empty() || credits_[level] == 0) {
+      if (++level == kServicePriorityCount) {
+        NewRound();
+        level = 0;
+      }
+    }
+
+    --credits_[level];
+    PopLevel(level, x);
+    return true;
+  }
+
+  // pops the older half (rounded up) of each priority into *out, used by work
+  // stealing
+  size_type popHalf(std::vector<T>* out) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    size_type total = 0;
+    for (int level = 0; level < kServicePriorityCount; ++level) {
+      size_type const n = (levels_[level].size() + 1) / 2;
+      for (size_type i = 0; i < n; ++i) {
+        out->emplace_back();
+        PopLevel(level, &out->back());
+      }
+      total += n;
+    }
+    return total;
+  }
+
+  bool empty() {
+    std::lock_guard<std::mutex> lg(mutex_);
+    return size_ == 0;
+  }
+
+  bool empty_unsyn() {
+    return nonempty_.load(std::memory_order_seq_cst) == 0;
+  }
+
+  size_type size_unsyn() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return size_;
+  }
+
+  // the highest priority level queued, kServicePriorityCount if empty
+  int top_unsyn() const {
+    unsigned const mask = nonempty_.load(std::memory_order_relaxed);
+    return mask ? __builtin_ctz(mask) : kServicePriorityCount;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lg(mutex_);
+    for (auto& level : levels_) {
+      level.clear();
+    }
+    size_ = 0;
+    nonempty_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  void NewRound() {
+    credits_[0] = kHighWeight;
+    credits_[1] = kNormalWeight;
+    credits_[2] = kLowWeight;
+  }
+
+  void PushLocked(T&& x, ServicePriority priority) {
+    int const level = static_cast<int>(priority);
+    levels_[level].push_back(std::move(x));
+    ++size_;
+    nonempty_.store(nonempty_.load(std::memory_order_relaxed) | (1U << level),
+                    std::memory_order_relaxed);
+  }
+
+  void PopLevel(int level, T* x) {
+    *x = std::move(levels_[level].front());
+    levels_[level].pop_front();
+    --size_;
+    if (levels_[level].empty()) {
+      nonempty_.store(nonempty_.load(std::memory_order_relaxed) & ~(1U << level),
+                      std::memory_order_relaxed);
+    }
+  }
+
+  std::mutex mutex_;
+  std::deque<T> levels_[kServicePriorityCount];
+  size_type size_ = 0;
+  bool closed_ = false;
+  std::atomic<unsigned> nonempty_{0};  // a bit per non-empty level, for unlocked peeks
+  unsigned credits_[kServicePriorityCount] = {kHighWeight, kNormalWeight, kLowWeight};
+};
+
+template <typename T>
+constexpr unsigned ReadyQueue<T>::kHighWeight;
+template <typename T>
+constexpr unsigned ReadyQueue<T>::kNormalWeight;
+template <typename T>
+constexpr unsigned ReadyQueue<T>::kLowWeight;
+
+}  // namespace mcast
+
+#endif  // CAST_READYQUEUE_H_
@@ -0,0 +1,100 @@
+#include "ReadyQueue.h"
+
+#include <vector>
+
+#include "util/Test.h"
+
+using namespace mcast;
+
+TEST(ReadyQueueTest, WeightedRoundRobinTestCase) {
+  ReadyQueue<int> q;
+  ASSERT_TRUE(q.empty());
+  ASSERT_EQ(q.top_unsyn(), kServicePriorityCount);
+
+  const int n = 100;
+  for (int i = 0; i < n; ++i) {
+    q.push(static_cast<int>(ServicePriority::kLow), ServicePriority::kLow);
+    q.push(static_cast<int>(ServicePriority::kNormal), ServicePriority::kNormal);
+    q.push(static_cast<int>(ServicePriority::kHigh), ServicePriority::kHigh);
+  }
+  ASSERT_EQ(q.size_unsyn(), 3U * n);
+  ASSERT_EQ(q.top_unsyn(), static_cast<int>(ServicePriority::kHigh));
+
+  // each round pops every priority in proportion to its weight
+  const unsigned round =
+      ReadyQueue<int>::kHighWeight + ReadyQueue<int>::kNormalWeight + ReadyQueue<int>::kLowWeight;
+  for (int r = 0; r < 4; ++r) {
+    unsigned popped[kServicePriorityCount] = {0, 0, 0};
+    for (unsigned i = 0; i < round; ++i) {
+      int x = -1;
+      ASSERT_TRUE(q.pop(&x));
+      ++popped[x];
+    }
+    ASSERT_EQ(popped[0], ReadyQueue<int>::kHighWeight);
+    ASSERT_EQ(popped[1], ReadyQueue<int>::kNormalWeight);
+    ASSERT_EQ(popped[2], ReadyQueue<int>::kLowWeight);
+  }
+
+  int x = -1;
+  size_t left = 0;
+  while (q.pop(&x)) {
+    ++left;
+  }
+  ASSERT_EQ(left, 3U * n - 4 * round);
+  ASSERT_TRUE(q.empty());
+  ASSERT_TRUE(q.empty_unsyn());
+}
+
+TEST(ReadyQueueTest, HighPriorityLatencyTestCase) {
+  ReadyQueue<int> q;
+  for (int i = 0; i < 1000; ++i) {
+    q.push(1, ServicePriority::kNormal);
+    q.push(2, ServicePriority::kLow);
+  }
+
+  // a high priority element waits for at most one round of the others
+  for (int r = 0; r < 100; ++r) {
+    q.push(0, ServicePriority::kHigh);
+    unsigned pops = 0;
+    int x = -1;
+    do {
+      ASSERT_TRUE(q.pop(&x));
+      ++pops;
+    } while (x != 0);
+    ASSERT_LE(pops, ReadyQueue<int>::kNormalWeight + ReadyQueue<int>::kLowWeight + 1);
+  }
+}
+
+TEST(ReadyQueueTest, PopHalfTestCase) {
+  ReadyQueue<int> q;
+  for (int i = 0; i < 4; ++i) {
+    q.push(0, ServicePriority::kHigh);
+  }
+  for (int i = 0; i < 3; ++i) {
+    q.push(2, ServicePriority::kLow);
+  }
+
+  std::vector<int> out;
+  ASSERT_EQ(q.popHalf(&out), 4U);
+  ASSERT_EQ(out, std::vector<int>({0, 0, 2, 2}));
+  ASSERT_EQ(q.size_unsyn(), 3U);
+  ASSERT_EQ(q.top_unsyn(), static_cast<int>(ServicePriority::kHigh));
+
+  q.clear();
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(ReadyQueueTest, CloseTestCase) {
+  ReadyQueue<int> q;
+  ASSERT_TRUE(q.try_push(1, ServicePriority::kNormal));
+
+  q.close();
+  int x = 2;
+  ASSERT_FALSE(q.try_push(std::move(x), ServicePriority::kNormal));
+  q.push(3, ServicePriority::kNormal);
+  ASSERT_EQ(q.size_unsyn(), 2U);
+
+  q.open();
+  ASSERT_TRUE(q.try_push(4, ServicePriority::kNormal));
+  ASSERT_EQ(q.size_unsyn(), 3U);
+}
@@ -7,7 +7,15 @@ namespace mcast {
 Service::~Service() {}
 
 void Service::Yield() {
-  system()->Schedule();
+  system()->YieldService();
+}
+
+void Service::ConsumeBudget() {
+  system()->ConsumeExecutionBudget(this);
+}
+
+void Service::ChargeMethodCall(Timestamp start) {
+  system()->ChargeMethodCall(this, start);
 }
 
 Status Service::WaitInput(int fd) {
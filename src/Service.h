@@ -2,6 +2,7 @@
 #define CAST_SERVICE_H_
 
 #include <stdint.h>
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -13,8 +14,11 @@
 #include "Message.h"
 #include "ServiceContext.h"
 #include "ServiceHandle.h"
+#include "util/IntrusivePtr.h"
 #include "util/Noncopyable.h"
+#include "util/Span.h"
 #include "util/Status.h"
+#include "util/Timer.h"
 
 namespace mcast {
 
@@ -26,7 +30,7 @@ class Service : public Noncopyable {
   template <typename T>
   using BasicHandle = BasicHandle<T>;
 
-  typedef std::shared_ptr<Service> ServicePtr;
+  typedef IntrusivePtr<Service> ServicePtr;
 
   enum Type {
     kNone = 1,
@@ -73,6 +77,10 @@ class Service : public Noncopyable {
   void Yield();
   Status Sleep(uint32_t milliseconds);
 
+  // charges an operation to the execution budget of this service, which must
+  // be the running one, and yields once the budget is used up
+  void ConsumeBudget();
+
   Status WaitSignal();
   Status WaitInput(int fd);
   Status WaitOutput(int fd);
@@ -89,6 +97,9 @@ class Service : public Noncopyable {
   virtual void OnServiceStart() {}
   virtual void OnServiceStop() {}
 
+  // accounts a method handled since start, see ServiceStats
+  void ChargeMethodCall(Timestamp start);
+
  private:
   friend class System;
 
@@ -96,11 +107,27 @@ class Service : public Noncopyable {
     return context_.get();
   }
 
-  void SetContext(const std::shared_ptr<ServiceContext>& contxt) {
-    context_ = contxt;
+  void SetContext(ServiceContextPtr&& contxt) {
+    context_ = std::move(contxt);
+  }
+
+  // the reference count is embedded, so copying a ServicePtr touches no
+  // control block and moving one touches nothing
+  friend void IntrusivePtrAddRef(Service* s) {
+    s->ref_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  friend void IntrusivePtrRelease(Service* s) {
+    if (s->ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete s;
+  }
+
+  friend long IntrusivePtrUseCount(const Service* s) {
+    return s->ref_count_.load(std::memory_order_relaxed);
   }
 
-  std::shared_ptr<ServiceContext> context_;
+  std::atomic<long> ref_count_{0};
+  ServiceContextPtr context_;
   System* system_ = nullptr;
   Handle handle_;
   std::string name_;
@@ -115,11 +142,34 @@ class MessageDrivenService : public Service {
  public:
   using Service::Service;
 
+  static constexpr size_t kDefaultMaxBatchSize = 64;
+
   virtual void HandleMessage(const MessagePtr& msg) = 0;
 
+  // called with up to MaxBatchSize() messages taken from the mailbox at once,
+  // override it to amortize work over a batch, e.g. one write per batch
+  virtual void HandleMessages(Span<const MessagePtr> msgs) {
+    for (auto& msg : msgs) {
+      HandleMessage(msg);
+    }
+  }
+
   Type ServiceType() const override {
     return kMessageDrivenService;
   }
+
+  size_t MaxBatchSize() const {
+    return max_batch_size_;
+  }
+
+ protected:
+  // must be called before the service is launched
+  void SetMaxBatchSize(size_t n) {
+    max_batch_size_ = n > 0 ? n : 1;
+  }
+
+ private:
+  size_t max_batch_size_ = kDefaultMaxBatchSize;
 };
 
 class MethodCallService : public MessageDrivenService {
@@ -145,7 +195,9 @@ class MethodCallService : public MessageDrivenService {
     // FIXME: remove dynamic_cast
     MethodCallMessage* mmsg = dynamic_cast<MethodCallMessage*>(msg.get());
     CHECK(mmsg);
+    auto const start = Timestamp::Now();
     mmsg->CallMethod(this);
+    ChargeMethodCall(start);
     mmsg->Done(Status::OK());
   }
 
@@ -1,9 +1,18 @@
 #include "ServiceContext.h"
 
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <utility>
 
 #include "Service.h"
 #include "ServiceHandle.h"
+#include "StackPool.h"
 #include "System.h"
 #include "util/Logging.h"
 
@@ -25,24 +34,42 @@ ServiceContext::~ServiceContext() {
 #endif
 
   if (stack)
-    munmap(stack, static_cast<size_t>(stack_size));
+    StackPool::Instance().Release(stack, static_cast<size_t>(stack_size));
 }
 
-ServiceContext::ServiceContextPtr ServiceContext::Create(Service* srv, System* /*sys*/,
+ServiceContext::ServiceContextPtr ServiceContext::Create(Service* srv, System* sys,
                                                          int stacksize,
                                                          void (*ServiceMain)(intptr_t)) {
   stacksize = (stacksize + kStackAlignmentMask) & ~kStackAlignmentMask;
 
-  void* page_addr = mmap(NULL, static_cast<size_t>(stacksize), PROT_READ | PROT_WRITE,
-                         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  if (MAP_FAILED == page_addr) {
+  bool fresh = false;
+  void* page_addr = StackPool::Instance().Allocate(static_cast<size_t>(stacksize), &fresh);
+  if (!page_addr) {
     throw std::bad_alloc();
   }
 
-  std::shared_ptr<ServiceContext> sc(new ServiceContext);
+  if (fresh && sys && sys->numa_aware()) {
+    // the pages are faulted in by the worker that first runs the service,
+    // whatever the memory policy of the process is
+    if (syscall(SYS_mbind, page_addr, static_cast<unsigned long>(stacksize), MPOL_LOCAL,
+                nullptr, 0UL, 0U) != 0) {
+      // the same for every stack, e.g. ENOSYS without NUMA support
+      static std::atomic<bool> warned{false};
+      int const err = errno;
+      if (!warned.exchange(true))
+        LOG_WARN << "ServiceContext: binding the stacks to the local node failed, " << err;
+    }
+  }
+
+  ServiceContextPtr sc(new ServiceContext);
   sc->srv = srv;
   sc->stack = static_cast<uint8_t*>(page_addr);
   sc->stack_size = stacksize;
+  if (sys && sys->stack_painting()) {
+    // touches every page, so the stack costs its full size from now on
+    memset(sc->stack, kStackPaint, static_cast<size_t>(stacksize));
+    sc->stack_painted = true;
+  }
 
 #ifdef VALGRIND
   sc->valg_ret = VALGRIND_STACK_REGISTER(sc->stack, sc->stack + sc->stack_size);
@@ -59,4 +86,40 @@ ServiceContext::ServiceContextPtr ServiceContext::Create(Service* srv, System* /
   return sc;
 }
 
+ServiceContext::ServiceContextPtr ServiceContext::CreateShared(Service* srv,
+                                                               void (*ServiceMain)(intptr_t)) {
+  ServiceContextPtr sc(new ServiceContext);
+  sc->srv = srv;
+  sc->shared_stack = true;
+  sc->service_main = ServiceMain;
+  sc->ucontext = nullptr;
+  LOG_TRACE << " ServiceContext::CreateShared " << srv->name();
+  return sc;
+}
+
+ServiceContext::ServiceContextPtr ServiceContext::CreateStackless(Service* srv) {
+  ServiceContextPtr sc(new ServiceContext);
+  sc->srv = srv;
+  sc->stackless = true;
+  sc->ucontext = nullptr;
+  LOG_TRACE << " ServiceContext::CreateStackless " << srv->name();
+  return sc;
+}
+
+uint64_t ServiceContext::ScanStackHighWater() {
+  if (!stack_painted)
+    return 0;
+
+  uint64_t paint;
+  memset(&paint, kStackPaint, sizeof paint);
+  auto const* p = reinterpret_cast<const uint64_t*>(stack);
+  auto const* const end = reinterpret_cast<const uint64_t*>(stack + stack_size);
+  while (p < end && (*p == paint || (stack_reclaimed && *p == 0)))
+    ++p;
+
+  stack_high_water = std::max(stack_high_water,
+                              static_cast<uint64_t>(end - p) * sizeof(uint64_t));
+  return stack_high_water;
+}
+
 }  // namespace mcast
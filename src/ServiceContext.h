@@ -5,15 +5,18 @@
 #include <sys/mman.h>
 
 #include <atomic>
-#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "libcontext.h"
 
+#include "Mailbox.h"
 #include "Message.h"
+#include "ReadyQueue.h"
 #include "ServiceEvent.h"
+#include "ServiceHandle.h"
 #include "TimerService.h"
 #include "config.h"
 #include "util/Logging.h"
@@ -35,7 +38,7 @@ class ServiceContext : public Noncopyable {
   static constexpr int kStackAlignmentMask = (kStackAlignment - 1);
 
  public:
-  typedef std::shared_ptr<ServiceContext> ServiceContextPtr;
+  typedef std::unique_ptr<ServiceContext> ServiceContextPtr;
   typedef fcontext_t ContextType;
 
   ServiceContext();
@@ -49,9 +52,51 @@ class ServiceContext : public Noncopyable {
   static ServiceContextPtr Create(Service* s, System* sys, int stacksize,
                                   void (*serviceMain)(intptr_t));
 
+  // a context without a stack of its own, see ServiceOptions::shared_stack.
+  // the context is made when the service first runs
+  static ServiceContextPtr CreateShared(Service* s, void (*serviceMain)(intptr_t));
+
+  // a context without a stack at all, see ServiceOptions::stackless
+  static ServiceContextPtr CreateStackless(Service* s);
+
+  // stack painting: a new stack is filled with kStackPaint, and the bytes no
+  // longer holding it were used. returns the deepest use seen so far, 0 if
+  // the stack was not painted. the service must not run meanwhile
+  static constexpr uint8_t kStackPaint = 0xa5;
+  uint64_t ScanStackHighWater();
+
+  ServicePriority priority = ServicePriority::kNormal;
+  int shard = -1;  // the worker it runs on in a sharded System
   int last_thread_index_ = -1;
+  uint64_t migrations = 0;
+
+  // operations charged since the service was resumed, only touched by the
+  // service itself. execution_budget 0 means unlimited
+  uint32_t execution_budget = 0;
+  uint32_t budget_used = 0;
+  std::atomic<uint64_t> budget_yields{0};
+
+  // cpu accounting in Timestamp counts, see ServiceStats. Only the service
+  // itself and the worker switching it write them, so they are bumped without
+  // read-modify-write atomics
+  std::atomic<uint64_t> run_start{0};
+  std::atomic<uint64_t> run_time{0};
+  std::atomic<uint64_t> switches{0};
+  std::atomic<uint64_t> messages_handled{0};
+  std::atomic<uint64_t> io_waits{0};
+  std::atomic<uint64_t> method_calls{0};
+  std::atomic<uint64_t> method_call_time{0};
+
+  static void Charge(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
   std::mutex mutex;
-  std::deque<MessagePtr> msg_queue;
+  Mailbox mailbox;
+
+  // senders blocked on the full mailbox, guarded by mutex
+  std::vector<ServiceHandle> mailbox_space_waiters;
+  std::atomic<bool> has_mailbox_space_waiters{false};
 
   bool wakeup_signal = false;
   bool is_swaping_out = false;
@@ -73,6 +118,22 @@ class ServiceContext : public Noncopyable {
   uint8_t* stack = nullptr;
   int stack_size = 0;
 
+  // stack painting, guarded by mutex once the service runs. the pages given
+  // back by System::ReclaimIdleStacks read as zeros
+  bool stack_painted = false;
+  bool stack_reclaimed = false;
+  uint64_t stack_high_water = 0;
+
+  // shared stack mode: the live bytes of the stack while another service
+  // runs on the shared stack of the worker
+  bool shared_stack = false;
+  void (*service_main)(intptr_t) = nullptr;
+  std::vector<uint8_t> saved_stack;
+
+  // stackless mode: the handlers run on the stack of the idle service
+  bool stackless = false;
+  bool started = false;  // OnServiceStart was called
+
 #ifdef VALGRIND
   int valg_ret = -1;
 #endif
@@ -4,7 +4,8 @@ namespace mcast {
 
 static const char* s_service_event_texts[] = {
     "NoneEvent", "ServiceStart", "Signal", "Interrupt", "Message",    "Request",
-    "Response",  "IO_Operation", "Sleep",  "Timeout",   "ServiceStop"};
+    "Response",  "IO_Operation", "Sleep",  "Timeout",   "ServiceStop",
+    "MailboxSpace"};
 
 std::string ServiceEventToText(unsigned x) {
   std::string str = "[";
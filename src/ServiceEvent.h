@@ -17,7 +17,8 @@ struct ServiceEvent {
   const static unsigned kSleep = 1U << 7;
   const static unsigned kTimeout = 1U << 8;
   const static unsigned kServiceStop = 1U << 9;
-  const static unsigned kCount = 11;
+  const static unsigned kMailboxSpace = 1U << 10;
+  const static unsigned kCount = 12;
   // warnning: change the s_service_event_texts
 
   unsigned events = kNoneEvent;
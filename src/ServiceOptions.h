@@ -0,0 +1,54 @@
+#ifndef CAST_SERVICEOPTIONS_H_
+#define CAST_SERVICEOPTIONS_H_
+
+#include <stdint.h>
+
+#include <limits>
+
+#include "Mailbox.h"
+#include "ReadyQueue.h"
+
+namespace mcast {
+
+// ServiceOptions are fixed when the service is launched
+struct ServiceOptions {
+  static constexpr uint32_t kUnlimitedExecutionBudget =
+      std::numeric_limits<uint32_t>::max();
+
+  // the maximum number of queued messages, 0 means unbounded
+  uint64_t mailbox_capacity = 0;
+
+  // what SendMessage does when the mailbox is full
+  MailboxOverflowPolicy overflow_policy = MailboxOverflowPolicy::kFailFast;
+
+  // ready services of a higher priority run first, see ReadyQueue
+  ServicePriority priority = ServicePriority::kNormal;
+
+  // the operations the service runs before it yields to other ready services,
+  // 0 means the budget of the System, see System::SetExecutionBudget
+  uint32_t execution_budget = 0;
+
+  // the shard of a sharded System the service runs on, taken modulo the
+  // number of shards. -1 picks the shards round robin
+  int shard = -1;
+
+  // runs the service on the stack its worker shares with the other such
+  // services, and keeps only its live stack bytes, copied out when another
+  // one needs the stack. For the many services idling in WaitInput. Only a
+  // sharded System supports it, as the stack bytes go back to the same
+  // addresses. While blocked, the addresses of its locals are not valid: it
+  // must not wait for another service writing through them, as in a
+  // CallMethod with a pointer to a local for the result
+  bool shared_stack = false;
+
+  // runs the handlers of a MessageDrivenService right on the stack of the
+  // worker's scheduler, with no stack and no context switch of its own. For
+  // the services whose handlers never block: a Wait, a Sleep, a WaitIO or a
+  // CallMethod from one fails a CHECK, and a SendMessage to a full kBlock
+  // mailbox returns kAgain
+  bool stackless = false;
+};
+
+}  // namespace mcast
+
+#endif  // CAST_SERVICEOPTIONS_H_
@@ -0,0 +1,76 @@
+#ifndef CAST_SERVICEPOOL_H_
+#define CAST_SERVICEPOOL_H_
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ServiceHandle.h"
+
+namespace mcast {
+
+// ServicePool is a set of identical services sharing the load of a single
+// one, see System::LaunchServicePool. A call is routed to one member by the
+// hash of a key, so the calls with the same key always reach the same member
+// and its state, or round robin for stateless members. Copies share the
+// members and the round robin position.
+template <typename T>
+class ServicePool {
+ public:
+  typedef BasicHandle<T> Handle;
+
+  ServicePool() = default;
+
+  explicit ServicePool(std::vector<Handle>&& members)
+      : shared_(std::make_shared<Shared>(std::move(members))) {}
+
+  explicit operator bool() const {
+    return shared_ && !shared_->members.empty();
+  }
+
+  size_t size() const {
+    return shared_ ? shared_->members.size() : 0;
+  }
+
+  const Handle& operator[](size_t i) const {
+    return shared_->members[i];
+  }
+
+  // empty for an empty pool
+  const std::vector<Handle>& members() const {
+    static const std::vector<Handle> kNoMembers;
+    return shared_ ? shared_->members : kNoMembers;
+  }
+
+  // the pool must not be empty
+  template <typename Key>
+  const Handle& Route(const Key& key) const {
+    assert(*this);
+    return shared_->members[std::hash<Key>()(key) % shared_->members.size()];
+  }
+
+  const Handle& Next() const {
+    assert(*this);
+    size_t const i = shared_->next.fetch_add(1, std::memory_order_relaxed);
+    return shared_->members[i % shared_->members.size()];
+  }
+
+ private:
+  struct Shared {
+    explicit Shared(std::vector<Handle>&& m) : members(std::move(m)) {}
+
+    const std::vector<Handle> members;
+    std::atomic<size_t> next{0};
+  };
+
+  std::shared_ptr<Shared> shared_;
+};
+
+}  // namespace mcast
+
+#endif  // CAST_SERVICEPOOL_H_
@@ -0,0 +1,80 @@
+#ifndef CAST_SERVICESTATS_H_
+#define CAST_SERVICESTATS_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "ServiceHandle.h"
+
+namespace mcast {
+
+struct ServiceStats {
+  std::string name;
+  ServiceHandle handle;
+
+  // times the service was resumed on a different worker than the last time
+  uint64_t migrations = 0;
+
+  // the stack of its own, 0 for a shared stack or stackless service
+  uint64_t stack_size = 0;
+
+  // messages queued now, the most ever queued and the ones dropped by
+  // MailboxOverflowPolicy::kDropOldest
+  uint64_t mailbox_depth = 0;
+  uint64_t mailbox_high_watermark = 0;
+  uint64_t mailbox_dropped = 0;
+
+  // times the service used up its execution budget
+  uint64_t budget_yields = 0;
+
+  // time spent running, from being switched in to being switched out, and
+  // the times it was switched in
+  uint64_t cpu_time_ns = 0;
+  uint64_t switches = 0;
+
+  uint64_t messages_handled = 0;
+  uint64_t io_waits = 0;
+
+  // methods run by MethodCallService::Dispatch and the time spent in them
+  uint64_t method_calls = 0;
+  uint64_t method_call_time_ns = 0;
+
+  uint64_t AverageMethodCallNs() const {
+    return method_calls > 0 ? method_call_time_ns / method_calls : 0;
+  }
+};
+
+// the stack use of the services of one name, see System::SetStackPainting
+struct StackUsageStats {
+  std::string name;
+
+  // services measured at their exit
+  uint64_t exited = 0;
+
+  // the largest stack one of them got and the deepest any of them used, the
+  // live services included as of the last scan
+  uint64_t stack_size = 0;
+  uint64_t high_water = 0;
+
+  // what the next one gets in auto sizing mode, 0 when it is off
+  uint64_t auto_stack_size = 0;
+};
+
+struct WorkerPoolStats {
+  // running workers now, the limits of an elastic pool
+  int workers = 0;
+  int min_workers = 0;
+  int max_workers = 0;
+
+  // resize events of an elastic pool
+  uint64_t workers_added = 0;
+  uint64_t workers_retired = 0;
+
+  // services found holding a worker beyond the watchdog threshold
+  uint64_t stalls = 0;
+};
+
+}  // namespace mcast
+
+#endif  // CAST_SERVICESTATS_H_
@@ -0,0 +1,143 @@
+#include "ServiceTable.h"
+
+#include <assert.h>
+
+#include "util/util.h"
+
+namespace mcast {
+
+ServiceTable::ServiceTable() : chunks_(new std::atomic<Slot*>[kMaxChunks]) {
+  for (uint32_t i = 0; i < kMaxChunks; ++i) {
+    chunks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+ServiceTable::~ServiceTable() {
+  for (uint32_t i = 0; i < kMaxChunks; ++i) {
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+  }
+}
+
+ServiceTable::IndexType ServiceTable::Insert(const ServicePtr& srv) {
+  uint32_t slot_index;
+  std::vector<ServicePtr> released;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    DrainPending(&released);
+    if (!free_slots_.empty()) {
+      // reuse the oldest free slot, so generations of a slot wrap as late as possible
+      slot_index = free_slots_.front();
+      free_slots_.pop_front();
+    } else {
+      slot_index = num_slots_.load(std::memory_order_relaxed);
+      const uint32_t chunk = slot_index >> kChunkBits;
+      CHECK_LT(chunk, kMaxChunks);
+      if (!chunks_[chunk].load(std::memory_order_relaxed))
+        chunks_[chunk].store(new Slot[kChunkSize], std::memory_order_release);
+      num_slots_.store(slot_index + 1, std::memory_order_release);
+    }
+  }
+
+  // the slot is free, Find and ForEach may pin it but never touch srv
+  Slot* const slot = SlotAt(slot_index);
+  uint64_t s = slot->state.load(std::memory_order_relaxed);
+  assert(Status(s) == kFree);
+  uint32_t gen = Generation(s) + 1;
+  if (gen > kMaxGeneration)
+    gen = 1;
+
+  const auto index =
+      static_cast<IndexType>(static_cast<uint64_t>(gen) << 32 | slot_index);
+  srv->handle(ServiceHandle(index));
+  slot->srv = srv;
+  slot->index = slot_index;
+  while (!slot->state.compare_exchange_weak(s, MakeState(gen, kLive, Pins(s)),
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+  }
+
+  return index;
+}
+
+ServicePtr ServiceTable::Find(IndexType index) const {
+  const uint32_t slot_index = SlotOf(index);
+  if (slot_index >= num_slots_.load(std::memory_order_acquire))
+    return ServicePtr();
+
+  ServicePtr srv;
+  Slot* const slot = SlotAt(slot_index);
+  uint64_t const s = slot->state.fetch_add(1, std::memory_order_acquire);
+  if (Status(s) == kLive && Generation(s) == GenerationOf(index))
+    srv = slot->srv;
+  Unpin(slot);
+  return srv;
+}
+
+bool ServiceTable::Remove(IndexType index) {
+  const uint32_t slot_index = SlotOf(index);
+  if (slot_index >= num_slots_.load(std::memory_order_acquire))
+    return false;
+
+  const uint32_t gen = GenerationOf(index);
+  Slot* const slot = SlotAt(slot_index);
+  uint64_t s = slot->state.load(std::memory_order_relaxed);
+  do {
+    if (Status(s) != kLive || Generation(s) != gen)
+      return false;
+  } while (!slot->state.compare_exchange_weak(s, MakeState(gen, kDead, Pins(s)),
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_relaxed));
+
+  if (Pins(s) == 0)
+    TryRetire(slot, gen);
+
+  std::vector<ServicePtr> released;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    DrainPending(&released);
+  }
+  return true;
+}
+
+void ServiceTable::Unpin(Slot* slot) const {
+  uint64_t const s = slot->state.fetch_sub(1, std::memory_order_acq_rel);
+  if (Pins(s) == 1 && Status(s) == kDead)
+    TryRetire(slot, Generation(s));
+}
+
+void ServiceTable::TryRetire(Slot* slot, uint32_t gen) const {
+  // only one of the threads dropping the last pin of a dead slot claims it
+  uint64_t expected = MakeState(gen, kDead, 0);
+  if (!slot->state.compare_exchange_strong(expected, MakeState(gen, kPending, 0),
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_relaxed)) {
+    return;
+  }
+
+  // a push only, DrainPending takes the whole list at once
+  Slot* head = pending_.load(std::memory_order_relaxed);
+  do {
+    slot->next_pending = head;
+  } while (!pending_.compare_exchange_weak(head, slot, std::memory_order_release,
+                                           std::memory_order_relaxed));
+}
+
+void ServiceTable::DrainPending(std::vector<ServicePtr>* released) {
+  Slot* slot = pending_.exchange(nullptr, std::memory_order_acquire);
+  while (slot) {
+    Slot* const next = slot->next_pending;
+    released->push_back(std::move(slot->srv));
+
+    // readers may pin it meanwhile, they leave a pending slot alone
+    uint64_t s = slot->state.load(std::memory_order_relaxed);
+    assert(Status(s) == kPending);
+    while (!slot->state.compare_exchange_weak(s, MakeState(Generation(s), kFree, Pins(s)),
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+    }
+    free_slots_.push_back(slot->index);
+    slot = next;
+  }
+}
+
+}  // namespace mcast
@@ -0,0 +1,130 @@
+#ifndef CAST_SERVICETABLE_H_
+#define CAST_SERVICETABLE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Service.h"
+#include "ServiceHandle.h"
+#include "util/Noncopyable.h"
+
+namespace mcast {
+
+// ServiceTable maps service handles to services.
+//
+// A handle index encodes a slot and the generation of the slot,
+// (generation << 32) | slot, the generation is bumped each time a slot is
+// reused so a stale handle never finds the service living in its old slot.
+//
+// Find is wait-free: it pins the slot with one fetch_add on the slot state,
+// copies the service if the generation matches, and unpins. A reader dropping
+// the last pin of a removed slot only pushes the slot on a lock-free pending
+// list. Insert and Remove free the pending slots under the mutex, so the
+// readers never lock and never run the destructor of a service.
+class ServiceTable : public Noncopyable {
+ public:
+  typedef ServiceHandle::IndexType IndexType;
+
+  ServiceTable();
+  ~ServiceTable();
+
+  // stores srv, assigns its handle and returns the handle index
+  IndexType Insert(const ServicePtr& srv);
+
+  ServicePtr Find(IndexType index) const;
+  bool Remove(IndexType index);
+
+  // calls f(const ServicePtr&) for each live service
+  template <typename Function>
+  void ForEach(Function&& f) const;
+
+  static uint32_t SlotOf(IndexType index) {
+    return static_cast<uint32_t>(static_cast<uint64_t>(index) & 0xffffffffU);
+  }
+
+  static uint32_t GenerationOf(IndexType index) {
+    return static_cast<uint32_t>(static_cast<uint64_t>(index) >> 32);
+  }
+
+ private:
+  // Slot::state: generation(30 bits) | status(2 bits) | pins(32 bits)
+  // kPending: dead and unpinned, waiting on pending_ to be freed
+  enum SlotStatus : uint64_t { kFree = 0, kLive = 1, kDead = 2, kPending = 3 };
+
+  static constexpr int kPinBits = 32;
+  static constexpr int kStatusBits = 2;
+  static constexpr int kGenerationShift = kPinBits + kStatusBits;
+  static constexpr uint64_t kPinMask = (1ULL << kPinBits) - 1;
+  static constexpr uint32_t kMaxGeneration = (1U << 30) - 1;
+
+  static constexpr int kChunkBits = 12;
+  static constexpr uint32_t kChunkSize = 1U << kChunkBits;
+  static constexpr uint32_t kMaxChunks = 1U << 14;
+
+  struct Slot {
+    std::atomic<uint64_t> state{0};
+    ServicePtr srv;
+    uint32_t index = 0;
+    Slot* next_pending = nullptr;
+  };
+
+  static uint64_t Pins(uint64_t s) {
+    return s & kPinMask;
+  }
+
+  static uint64_t Status(uint64_t s) {
+    return (s >> kPinBits) & ((1ULL << kStatusBits) - 1);
+  }
+
+  static uint32_t Generation(uint64_t s) {
+    return static_cast<uint32_t>(s >> kGenerationShift);
+  }
+
+  static uint64_t MakeState(uint32_t gen, uint64_t status, uint64_t pins) {
+    return static_cast<uint64_t>(gen) << kGenerationShift | status << kPinBits | pins;
+  }
+
+  Slot* SlotAt(uint32_t slot) const {
+    return &chunks_[slot >> kChunkBits].load(std::memory_order_acquire)
+                [slot & (kChunkSize - 1)];
+  }
+
+  void Unpin(Slot* slot) const;
+  void TryRetire(Slot* slot, uint32_t gen) const;
+  // frees the pending slots, mutex_ is locked. the services are moved to
+  // *released, to be destroyed once it is unlocked
+  void DrainPending(std::vector<ServicePtr>* released);
+
+  std::unique_ptr<std::atomic<Slot*>[]> chunks_;
+  std::atomic<uint32_t> num_slots_{0};
+
+  mutable std::atomic<Slot*> pending_{nullptr};
+
+  std::mutex mutex_;  // guards allocation and free_slots_
+  std::deque<uint32_t> free_slots_;
+};
+
+template <typename Function>
+void ServiceTable::ForEach(Function&& f) const {
+  const uint32_t n = num_slots_.load(std::memory_order_acquire);
+  for (uint32_t i = 0; i < n; ++i) {
+    Slot* const slot = SlotAt(i);
+    ServicePtr srv;
+    uint64_t const s = slot->state.fetch_add(1, std::memory_order_acquire);
+    if (Status(s) == kLive)
+      srv = slot->srv;
+    Unpin(slot);
+
+    if (srv)
+      f(srv);
+  }
+}
+
+}  // namespace mcast
+
+#endif  // CAST_SERVICETABLE_H_
@@ -0,0 +1,88 @@
+#include "ServiceTable.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "util/Test.h"
+
+using namespace mcast;
+
+TEST(ServiceTableTest, InsertFindRemoveTestCase) {
+  ServiceTable table;
+  ServicePtr srv(new Service(nullptr, "ServiceTableTest"));
+
+  auto const index = table.Insert(srv);
+  ASSERT_EQ(srv->handle().index(), index);
+  ASSERT_GT(index, 1);
+  ASSERT_EQ(table.Find(index), srv);
+  ASSERT_FALSE(table.Find(index + 1));
+  ASSERT_FALSE(table.Find(-1));
+
+  ASSERT_TRUE(table.Remove(index));
+  ASSERT_FALSE(table.Remove(index));
+  ASSERT_FALSE(table.Find(index));
+  ASSERT_EQ(srv.use_count(), 1);
+}
+
+TEST(ServiceTableTest, StaleHandleTestCase) {
+  ServiceTable table;
+  ServicePtr srv1(new Service(nullptr, "ServiceTableTest1"));
+  auto const index1 = table.Insert(srv1);
+  ASSERT_TRUE(table.Remove(index1));
+
+  // the slot is reused with a new generation
+  ServicePtr srv2(new Service(nullptr, "ServiceTableTest2"));
+  auto const index2 = table.Insert(srv2);
+  ASSERT_EQ(ServiceTable::SlotOf(index1), ServiceTable::SlotOf(index2));
+  ASSERT_NE(index1, index2);
+  ASSERT_FALSE(table.Find(index1));
+  ASSERT_FALSE(table.Remove(index1));
+  ASSERT_EQ(table.Find(index2), srv2);
+
+  int n = 0;
+  table.ForEach([&n, &srv2](const ServicePtr& s) {
+    ASSERT_EQ(s, srv2);
+    ++n;
+  });
+  ASSERT_EQ(n, 1);
+}
+
+TEST(ServiceTableTest, ConcurrentFindRemoveTestCase) {
+  ServiceTable table;
+  std::atomic<bool> done{false};
+  std::vector<std::atomic<ServiceTable::IndexType>> indexes(64);
+  for (auto& index : indexes) {
+    index = table.Insert(ServicePtr(new Service(nullptr, "ServiceTableTest")));
+  }
+
+  std::vector<std::thread> finders;
+  for (int t = 0; t < 2; ++t) {
+    finders.emplace_back([&table, &done, &indexes] {
+      while (!done) {
+        for (auto& index : indexes) {
+          auto const i = index.load();
+          auto srv = table.Find(i);
+          if (srv) {
+            ASSERT_EQ(srv->handle().index(), i);
+          }
+        }
+      }
+    });
+  }
+
+  for (int round = 0; round < 1000; ++round) {
+    auto& index = indexes[static_cast<size_t>(round) % indexes.size()];
+    ASSERT_TRUE(table.Remove(index));
+    index = table.Insert(ServicePtr(new Service(nullptr, "ServiceTableTest")));
+  }
+
+  done = true;
+  for (auto& t : finders) {
+    t.join();
+  }
+
+  int n = 0;
+  table.ForEach([&n](const ServicePtr&) { ++n; });
+  ASSERT_EQ(n, 64);
+}
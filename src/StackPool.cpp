@@ -0,0 +1,178 @@
+#include "StackPool.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <utility>
+
+#include "util/Logging.h"
+
+namespace mcast {
+
+struct StackPool::ThreadCache {
+  struct List {
+    size_t size;
+    std::vector<void*> stacks;
+  };
+
+  ~ThreadCache();
+
+  std::vector<void*>* Find(size_t size, bool create) {
+    // a few stack sizes are in use, a linear search is the fastest
+    for (auto& l : lists) {
+      if (l.size == size)
+        return &l.stacks;
+    }
+    if (!create)
+      return nullptr;
+
+    lists.push_back(List{size, {}});
+    return &lists.back().stacks;
+  }
+
+  std::vector<List> lists;
+};
+
+// the stacks released while the thread exits, after its cache is gone, go to
+// the global pool
+static thread_local bool t_cache_destroyed = false;
+
+StackPool::ThreadCache::~ThreadCache() {
+  t_cache_destroyed = true;
+  for (auto& l : lists) {
+    for (void* stack : l.stacks) {
+      StackPool::Instance().ReleaseToGlobal(stack, l.size);
+    }
+  }
+}
+
+static void LogMapFailure(const char* call, int err) {
+  if (err == ENOMEM) {
+    LOG_WARN << "StackPool: " << call << " failed with ENOMEM, the process may be out of "
+             << "vm.max_map_count maps, each guarded stack takes two. raise it or "
+             << "turn the guard pages off";
+  } else {
+    LOG_WARN << "StackPool: " << call << " failed, " << err;
+  }
+}
+
+StackPool& StackPool::Instance() {
+  // never destroyed, the thread caches of the threads exiting last use it
+  static StackPool* pool = new StackPool;
+  return *pool;
+}
+
+StackPool::ThreadCache& StackPool::LocalCache() {
+  static thread_local ThreadCache cache;
+  return cache;
+}
+
+void* StackPool::Allocate(size_t size, bool* fresh) {
+  *fresh = false;
+  if (!t_cache_destroyed) {
+    auto* const stacks = LocalCache().Find(size, false);
+    if (stacks && !stacks->empty()) {
+      void* const stack = stacks->back();
+      stacks->pop_back();
+      reused_.fetch_add(1, std::memory_order_relaxed);
+      return stack;
+    }
+  }
+
+  if (global_count_.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> gl(mutex_);
+    auto it = global_.find(size);
+    if (it != global_.end() && !it->second.empty()) {
+      void* const stack = it->second.back();
+      it->second.pop_back();
+      global_count_.fetch_sub(1, std::memory_order_relaxed);
+      reused_.fetch_add(1, std::memory_order_relaxed);
+      return stack;
+    }
+  }
+
+  // the guard page is reserved either way, so the stacks unmap alike
+  void* const base = mmap(NULL, size + kGuardSize, PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (MAP_FAILED == base) {
+    LogMapFailure("mmap", errno);
+    return nullptr;
+  }
+
+  // the stacks grow down, into the guard page
+  if (guard_pages_.load(std::memory_order_relaxed) &&
+      mprotect(base, kGuardSize, PROT_NONE) != 0) {
+    LogMapFailure("mprotect", errno);
+    munmap(base, size + kGuardSize);
+    return nullptr;
+  }
+
+  mapped_.fetch_add(1, std::memory_order_relaxed);
+  *fresh = true;
+  return static_cast<uint8_t*>(base) + kGuardSize;
+}
+
+void StackPool::Release(void* stack, size_t size) {
+  size_t const limit = thread_cached_.load(std::memory_order_relaxed);
+  if (limit > 0 && !t_cache_destroyed) {
+    auto* const stacks = LocalCache().Find(size, true);
+    if (stacks->size() < limit) {
+      stacks->push_back(stack);
+      return;
+    }
+  }
+
+  ReleaseToGlobal(stack, size);
+}
+
+void StackPool::ReleaseToGlobal(void* stack, size_t size) {
+  size_t const limit = global_cached_.load(std::memory_order_relaxed);
+  if (limit > 0) {
+    std::unique_lock<std::mutex> ul(mutex_);
+    if (global_[size].size() < limit) {
+      ul.unlock();
+      // the pages are faulted in again, zeroed, by the next service using it
+      madvise(stack, size, MADV_DONTNEED);
+
+      ul.lock();
+      auto& stacks = global_[size];
+      if (stacks.size() < limit) {
+        stacks.push_back(stack);
+        global_count_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  Unmap(stack, size);
+}
+
+void StackPool::Unmap(void* stack, size_t size) {
+  if (munmap(static_cast<uint8_t*>(stack) - kGuardSize, size + kGuardSize) != 0)
+    LOG_WARN << "StackPool: munmap failed, " << errno;
+  unmapped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void StackPool::Trim() {
+  std::unordered_map<size_t, std::vector<void*>> stacks;
+  {
+    std::lock_guard<std::mutex> gl(mutex_);
+    stacks.swap(global_);
+    global_count_.store(0, std::memory_order_relaxed);
+  }
+
+  for (auto& s : stacks) {
+    for (void* stack : s.second) {
+      Unmap(stack, s.first);
+    }
+  }
+}
+
+void StackPool::GetStats(Stats* stats) {
+  stats->mapped = mapped_.load(std::memory_order_relaxed);
+  stats->unmapped = unmapped_.load(std::memory_order_relaxed);
+  stats->reused = reused_.load(std::memory_order_relaxed);
+  stats->global_cached = global_count_.load(std::memory_order_relaxed);
+}
+
+}  // namespace mcast
@@ -0,0 +1,93 @@
+#ifndef CAST_STACKPOOL_H_
+#define CAST_STACKPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "util/Noncopyable.h"
+#include "util/util_config.h"
+
+namespace mcast {
+
+// StackPool recycles the service stacks, so launching a service does not cost
+// an mmap, a munmap and the page faults of a new stack each time.
+//
+// The free stacks are kept by size. Each thread caches a few stacks with
+// their pages, which the next service launched on the thread reuses hot; the
+// stacks overflowing the thread caches go to a global pool, which gives their
+// pages back to the kernel with madvise(MADV_DONTNEED) and keeps only the
+// address range. Stacks beyond both limits are unmapped.
+//
+// A stack is mapped with MAP_NORESERVE, so only the pages a service touches
+// cost memory, and with a guard page below it, so an overflow faults instead
+// of corrupting the mapping next to it. The guard page splits the mapping in
+// two, each stack costs two of the vm.max_map_count (65530 by default) maps
+// of the process, which caps it near 32k services; raise it or turn the
+// guard pages off to run more.
+class StackPool : public Noncopyable {
+ public:
+  struct Stats {
+    uint64_t mapped = 0;    // stacks mmapped
+    uint64_t unmapped = 0;  // stacks munmapped
+    uint64_t reused = 0;    // allocations served from the caches
+    uint64_t global_cached = 0;  // stacks in the global pool now
+  };
+
+  static constexpr size_t kGuardSize = kPageSize;
+  static constexpr size_t kDefaultThreadCached = 8;
+  static constexpr size_t kDefaultGlobalCached = 256;
+
+  static StackPool& Instance();
+
+  // the stacks kept per size in each thread cache and in the global pool,
+  // 0 and 0 turn the pool off
+  void SetLimits(size_t thread_cached, size_t global_cached) {
+    thread_cached_.store(thread_cached, std::memory_order_relaxed);
+    global_cached_.store(global_cached, std::memory_order_relaxed);
+  }
+
+  // off, the stacks mapped from now on cost a single map but an overflow
+  // goes unnoticed. on by default
+  void SetGuardPages(bool on) { guard_pages_.store(on, std::memory_order_relaxed); }
+
+  // size must be a multiple of the page size. *fresh tells whether the stack
+  // was just mapped. returns nullptr when mmap fails
+  void* Allocate(size_t size, bool* fresh);
+  void Release(void* stack, size_t size);
+
+  void GetStats(Stats* stats);
+
+  // gives the stacks of the global pool back, the thread caches are left
+  void Trim();
+
+ private:
+  struct ThreadCache;
+
+  StackPool() = default;
+
+  static ThreadCache& LocalCache();
+
+  void ReleaseToGlobal(void* stack, size_t size);
+  void Unmap(void* stack, size_t size);
+
+  std::atomic<size_t> thread_cached_{kDefaultThreadCached};
+  std::atomic<size_t> global_cached_{kDefaultGlobalCached};
+  std::atomic<bool> guard_pages_{true};
+
+  std::mutex mutex_;
+  std::unordered_map<size_t, std::vector<void*>> global_;  // guarded by mutex_
+  std::atomic<uint64_t> global_count_{0};  // changed under mutex_
+
+  std::atomic<uint64_t> mapped_{0};
+  std::atomic<uint64_t> unmapped_{0};
+  std::atomic<uint64_t> reused_{0};
+};
+
+}  // namespace mcast
+
+#endif  // CAST_STACKPOOL_H_
@@ -0,0 +1,162 @@
+#include "StackPool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+
+#include "util/Test.h"
+
+using namespace mcast;
+
+// sizes no service uses, so the tests see only their own stacks
+static const size_t kTestStackSize = 5 * 4096;
+
+// the permissions of the mapping holding addr, from /proc/self/maps
+static std::string Permissions(const void* addr) {
+  FILE* f = fopen("/proc/self/maps", "r");
+  if (!f)
+    return std::string();
+
+  auto const a = reinterpret_cast<uintptr_t>(addr);
+  std::string perms;
+  unsigned long begin = 0;
+  unsigned long end = 0;
+  char p[8] = {0};
+  char line[512];
+  while (fgets(line, sizeof line, f)) {
+    if (sscanf(line, "%lx-%lx %4s", &begin, &end, p) == 3 && begin <= a && a < end) {
+      perms = p;
+      break;
+    }
+  }
+  fclose(f);
+  return perms;
+}
+
+TEST(StackPoolTest, GuardPageTestCase) {
+  auto& pool = StackPool::Instance();
+  size_t const size = kTestStackSize + 3 * 4096;
+  bool fresh = false;
+  auto* const stack = static_cast<char*>(pool.Allocate(size, &fresh));
+  ASSERT_TRUE(stack);
+  ASSERT_EQ(Permissions(stack), "rw-p");
+  ASSERT_EQ(Permissions(stack + size - 1), "rw-p");
+  ASSERT_EQ(Permissions(stack - 1), "---p");
+  pool.Release(stack, size);
+}
+
+TEST(StackPoolTest, NoGuardPageTestCase) {
+  auto& pool = StackPool::Instance();
+  size_t const size = kTestStackSize + 5 * 4096;
+  pool.SetGuardPages(false);
+  bool fresh = false;
+  auto* const stack = static_cast<char*>(pool.Allocate(size, &fresh));
+  pool.SetGuardPages(true);
+  ASSERT_TRUE(stack);
+  ASSERT_TRUE(fresh);
+  ASSERT_EQ(Permissions(stack - 1), "rw-p");
+  pool.Release(stack, size);
+}
+
+TEST(StackPoolTest, ThreadCacheTestCase) {
+  auto& pool = StackPool::Instance();
+  pool.SetLimits(2, 4);
+  bool fresh = false;
+  auto* const a = static_cast<char*>(pool.Allocate(kTestStackSize, &fresh));
+  ASSERT_TRUE(a);
+  ASSERT_TRUE(fresh);
+  a[0] = 'a';
+  pool.Release(a, kTestStackSize);
+
+  // the thread cache keeps the pages
+  ASSERT_EQ(pool.Allocate(kTestStackSize, &fresh), a);
+  ASSERT_FALSE(fresh);
+  ASSERT_EQ(a[0], 'a');
+  pool.Release(a, kTestStackSize);
+  pool.SetLimits(StackPool::kDefaultThreadCached, StackPool::kDefaultGlobalCached);
+}
+
+TEST(StackPoolTest, GlobalPoolTestCase) {
+  auto& pool = StackPool::Instance();
+  size_t const size = kTestStackSize + 4096;
+  pool.SetLimits(1, 4);
+  StackPool::Stats before;
+  pool.GetStats(&before);
+
+  bool fresh = false;
+  auto* const a = static_cast<char*>(pool.Allocate(size, &fresh));
+  auto* const b = static_cast<char*>(pool.Allocate(size, &fresh));
+  ASSERT_TRUE(a && b);
+  memset(b, 0xab, size);
+  pool.Release(a, size);
+  pool.Release(b, size);  // overflows the thread cache
+
+  StackPool::Stats stats;
+  pool.GetStats(&stats);
+  ASSERT_EQ(stats.global_cached, before.global_cached + 1);
+  ASSERT_EQ(pool.Allocate(size, &fresh), a);
+  ASSERT_EQ(pool.Allocate(size, &fresh), b);
+  ASSERT_FALSE(fresh);
+  // the pages of the global pool were given back
+  ASSERT_EQ(b[0], 0);
+  ASSERT_EQ(b[size - 1], 0);
+
+  // over both limits the stacks are unmapped
+  pool.SetLimits(0, 0);
+  pool.Release(a, size);
+  pool.Release(b, size);
+  pool.GetStats(&stats);
+  ASSERT_EQ(stats.unmapped, before.unmapped + 2);
+  ASSERT_EQ(stats.mapped, before.mapped + 2);
+  ASSERT_EQ(stats.reused, before.reused + 2);
+  pool.SetLimits(StackPool::kDefaultThreadCached, StackPool::kDefaultGlobalCached);
+}
+
+TEST(StackPoolTest, GlobalLimitPerSizeTestCase) {
+  auto& pool = StackPool::Instance();
+  size_t const small = kTestStackSize + 6 * 4096;
+  size_t const large = kTestStackSize + 7 * 4096;
+  pool.SetLimits(0, 1);
+  StackPool::Stats before;
+  pool.GetStats(&before);
+
+  bool fresh = false;
+  void* const a = pool.Allocate(small, &fresh);
+  void* const b = pool.Allocate(small, &fresh);
+  void* const c = pool.Allocate(large, &fresh);
+  ASSERT_TRUE(a && b && c);
+  pool.Release(a, small);
+  pool.Release(c, large);  // a stack of another size still fits
+  pool.Release(b, small);
+
+  StackPool::Stats stats;
+  pool.GetStats(&stats);
+  ASSERT_EQ(stats.global_cached, before.global_cached + 2);
+  ASSERT_EQ(stats.unmapped, before.unmapped + 1);
+  ASSERT_EQ(pool.Allocate(small, &fresh), a);
+  ASSERT_EQ(pool.Allocate(large, &fresh), c);
+  pool.Release(a, small);
+  pool.Release(c, large);
+  pool.SetLimits(StackPool::kDefaultThreadCached, StackPool::kDefaultGlobalCached);
+}
+
+TEST(StackPoolTest, ThreadExitTestCase) {
+  auto& pool = StackPool::Instance();
+  size_t const size = kTestStackSize + 2 * 4096;
+  void* stack = nullptr;
+  std::thread t([&pool, &stack, size]() {
+    bool fresh = false;
+    stack = pool.Allocate(size, &fresh);
+    pool.Release(stack, size);
+  });
+  t.join();
+
+  // the cache of the exited thread went to the global pool
+  bool fresh = true;
+  ASSERT_EQ(pool.Allocate(size, &fresh), stack);
+  ASSERT_FALSE(fresh);
+  pool.Release(stack, size);
+  pool.Trim();
+}
@@ -0,0 +1,45 @@
+#ifndef CAST_STARTOPTIONS_H_
+#define CAST_STARTOPTIONS_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace mcast {
+
+typedef std::vector<int> CpuSet;
+
+// StartOptions configure the threads of a System, see System::Start
+struct StartOptions {
+  // the number of worker threads, 0 means 2
+  int worker_num = 0;
+
+  // worker i is pinned to worker_cpus[i % worker_cpus.size()], the IO poller
+  // and the timer thread to io_cpus and timer_cpus. an empty set leaves the
+  // thread to the kernel
+  std::vector<CpuSet> worker_cpus;
+  CpuSet io_cpus;
+  CpuSet timer_cpus;
+
+  // binds service stacks to the NUMA node of the worker that first runs them
+  // and makes idle workers steal from workers on their own node first
+  bool numa_aware = false;
+
+  // thread-per-core mode: every worker is a shard running only the services
+  // launched on it, see ServiceOptions::shard. ready services are passed
+  // between shards through SPSC rings and never stolen. the timer and the IO
+  // poller are still shared, elastic mode is off
+  bool sharded = false;
+
+  // elastic mode, enabled when max_workers > worker_num: a worker is added
+  // while services keep waiting in the ready queues and no worker is idle, up
+  // to max_workers, and a worker idle for worker_idle_timeout_ms is retired,
+  // down to min_workers. min_workers 0 means worker_num
+  int max_workers = 0;
+  int min_workers = 0;
+  uint32_t worker_idle_timeout_ms = 1000;
+};
+
+}  // namespace mcast
+
+#endif  // CAST_STARTOPTIONS_H_
@@ -1,11 +1,21 @@
 #include "System.h"
 
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <limits>
 #include <string>
 #include <utility>
 
+#include "StackPool.h"
 #include "WakeupService.h"
+#include "util/Futex.h"
 
 namespace mcast {
 
@@ -16,37 +26,130 @@ class IdleService : public UserThreadService {
   using UserThreadService::UserThreadService;
 
   void Main() override {
-    while (!this_thread::IsInterrupted() || system()->NeedSchedule()) {
-      if (!system()->Schedule()) {
-        system()->RebalanceReadyQueue();
+    System *const sys = system();
+    auto *const ptd = System::this_thread_data_;
+    int idle_rounds = 0;
+    while (!this_thread::IsInterrupted() || sys->NeedSchedule()) {
+      // a retired worker takes no new services, it leaves once it ran the
+      // ones already queued on it
+      if (ptd->retiring.load() && ptd->local_ready_queue.empty()) {
+        sys->OnWorkerBusy();
+        break;
       }
+
+      if (sys->Schedule() || sys->RebalanceReadyQueue(idle_rounds)) {
+        if (idle_rounds > 0) {  // spinning paid off, spin longer next time
+          ptd->idle_spin_rounds =
+              std::min(ptd->idle_spin_rounds * 2, int{System::kMaxIdleSpinRounds});
+        }
+        idle_rounds = 0;
+        continue;
+      }
+
+      if (!sys->idle_parking_ || ++idle_rounds < ptd->idle_spin_rounds) {
+        if (!ptd->spinning) {
+          ptd->spinning = true;
+          sys->spinning_workers_.fetch_add(1);
+        }
+        CpuRelax();
+        continue;
+      }
+
+      ptd->idle_spin_rounds =
+          std::max(ptd->idle_spin_rounds / 2, int{System::kMinIdleSpinRounds});
+      idle_rounds = 0;
+      sys->ParkWorker();
     }
   }
 };
 
-Status System::Start(int thread_num) {
+static void PinThisThread(const char *name, const CpuSet &cpus) {
+  if (!cpus.empty() && !this_thread::SetAffinity(cpus))
+    LOG_WARN << "System: pinning the " << name << " thread failed";
+}
+
+// the watchdog asks a stalled worker for its stack with this signal. a
+// realtime one, SIGURG would also take the TCP out-of-band notifications
+static int WatchdogSignal() {
+  return SIGRTMIN + 1;
+}
+
+static void PrintBacktrace(int) {
+  static const char kHeader[] = "watchdog: backtrace of a stalled worker\n";
+  void *frames[64];
+  int const n = backtrace(frames, 64);
+  ssize_t r = write(STDERR_FILENO, kHeader, sizeof kHeader - 1);
+  (void)r;
+  backtrace_symbols_fd(frames, n, STDERR_FILENO);
+}
+
+static bool InstallBacktraceHandler(struct sigaction *prev) {
+  // backtrace loads libgcc on its first use, which is not safe in a handler
+  void *frame = nullptr;
+  backtrace(&frame, 1);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = &PrintBacktrace;
+  sa.sa_flags = SA_RESTART;  // the worker may be stalled in a syscall
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(WatchdogSignal(), &sa, prev) != 0) {
+    LOG_WARN << "System: installing the watchdog signal handler failed, " << errno;
+    return false;
+  }
+  return true;
+}
+
+Status System::Start(const StartOptions &options) {
   CHECK(stopped);
 
   std::unique_lock<std::mutex> lk(mutex_);
-  int const worker_num = thread_num <= 0 ? 2 : thread_num;
+  int const worker_num = options.worker_num <= 0 ? 2 : options.worker_num;
   LOG_INFO << "System start, the number of threads:" << worker_num;
 
-  perthread_data_.resize(static_cast<size_t>(worker_num));
+  numa_aware_ = options.numa_aware;
+  sharded_ = options.sharded;
+  next_shard_ = 0;
+  worker_cpus_ = options.worker_cpus;
+  max_workers_ = sharded_ ? worker_num : std::max(options.max_workers, worker_num);
+  min_workers_ = !sharded_ && options.min_workers > 0
+                     ? std::min(options.min_workers, max_workers_)
+                     : worker_num;
+  worker_idle_timeout_ms_ = options.worker_idle_timeout_ms;
+  busy_checks_ = 0;
+  idle_checks_ = 0;
+  tracing_ = trace_events_ > 0;
+  if (tracing_)
+    tracer_.Start(max_workers_, trace_events_);
+  // each worker allocates its own PerthreadData, so it is first touched on the
+  // worker's NUMA node
+  perthread_data_.clear();
+  perthread_data_.resize(static_cast<size_t>(max_workers_));
+  worker_num_ = 0;
+  worker_init_num_ = 0;
   auto status = io_srv_.Initialize(this);
   if (!status) {
     LOG_WARN << "IOService Initialize error:" << status.ErrorText();
     return status;
   }
 
-  threads_.push_back(Thread().Run([this]() mutable { timer_srv_.Run(); }));
-  threads_.push_back(Thread().Run([this]() mutable { io_srv_.Run(); }));
+  threads_.push_back(Thread().Run([this, cpus = options.timer_cpus]() mutable {
+    PinThisThread("timer", cpus);
+    timer_srv_.Run();
+  }));
+  threads_.push_back(Thread().Run([this, cpus = options.io_cpus]() mutable {
+    PinThisThread("io", cpus);
+    io_srv_.Run();
+  }));
 
   for (int i = 0; i < worker_num; ++i) {
-    threads_.push_back(Thread().Run([this, i]() mutable { ThreadMain(i); }));
+    threads_.push_back(StartWorker(i));
   }
+  threads_.resize(kFirstWorkerThread + static_cast<size_t>(max_workers_));
 
   while (worker_init_num_.load() != worker_num)
     this_thread::Yield();
+  worker_num_.store(worker_num);
 
   stopped.store(false);  // must be set before StartBuitinServices
   status = StartBuitinServices();
@@ -56,9 +159,32 @@ Status System::Start(int thread_num) {
     return status;
   }
 
+  if (max_workers_ > worker_num || min_workers_ < worker_num) {
+    std::lock_guard<std::mutex> gl(workers_mutex_);
+    resize_timer_ = timer_srv_.AddTimer(kResizeIntervalMs, [this]() { ResizeWorkers(); });
+  }
+
+  if (watchdog_threshold_ms_ > 0) {
+    if (watchdog_backtrace_)
+      watchdog_handler_installed_ = InstallBacktraceHandler(&watchdog_prev_action_);
+    std::lock_guard<std::mutex> gl(workers_mutex_);
+    watchdog_timer_ = timer_srv_.AddTimer(WatchdogInterval(), [this]() { CheckStalledWorkers(); });
+  }
+
   return Status::OK();
 }
 
+Thread System::StartWorker(int thread_index) {
+  CpuSet cpus;
+  if (!worker_cpus_.empty())
+    cpus = worker_cpus_[static_cast<size_t>(thread_index) % worker_cpus_.size()];
+
+  return Thread().Run([this, thread_index, cpus]() mutable {
+    PinThisThread("worker", cpus);
+    ThreadMain(thread_index);
+  });
+}
+
 Status System::StartBuitinServices() {
   wakeup_srv_handle_ = LaunchService<WakeupService>("WakeupService");
   if (!wakeup_srv_handle_) {
@@ -78,16 +204,29 @@ void System::Stop() {
   stopped.store(true);
   StopAllService();
   io_srv_.Stop();
-  for (auto &t : threads_) {
-    t.Interrupt();
+  {
+    // ResizeWorkers sees stopped and leaves threads_ alone from now on
+    std::lock_guard<std::mutex> gl(workers_mutex_);
+    timer_srv_.DeleteTimer(resize_timer_);
+    timer_srv_.DeleteTimer(watchdog_timer_);
+    for (auto &t : threads_) {
+      t.Interrupt();
+    }
   }
+  UnparkAllWorkers();
 
   for (auto &t : threads_) {
     if (t.Joinable())
       t.Join();
   }
   threads_.clear();
-  CHECK(run_queue_.empty());
+
+  // the watchdog signals no worker once stopped, and they are gone now
+  if (watchdog_handler_installed_) {
+    sigaction(WatchdogSignal(), &watchdog_prev_action_, nullptr);
+    watchdog_handler_installed_ = false;
+  }
+  CHECK(!NeedSchedule());
   stop_cond_.notify_all();
 }
 
@@ -97,12 +236,10 @@ void System::WaitStop() {
 }
 
 void System::StopAllService() {
-  std::unique_lock<std::shared_timed_mutex> g(services_shared_mutex_);
-  auto ss = services_;
-  g.unlock();
-  for (auto &p : ss) {
-    auto &s = p.second;
-    if (s && s->handle().index() != idle_service_index_)
+  std::vector<ServicePtr> ss;
+  services_.ForEach([&ss](const ServicePtr &s) { ss.push_back(s); });
+  for (auto &s : ss) {
+    if (s->handle().index() != idle_service_index_)
       StopService(s);
   };
 }
@@ -170,22 +307,143 @@ void System::Signal(const Handle &h) {
   Wakeup_Locked(srv, ServiceEvent::kSignal);
 }
 
+// a stackless service runs on the idle service's stack: the idle service
+// runs it right away, any other service switches to the idle service instead
 bool System::Schedule() {
-  return SwitchTo(CurrentService(), GetReadyService());
+  Service *const cur_srv = CurrentService().get();
+  ServicePtr next_srv = GetReadyService();
+  if (next_srv->context()->stackless) {
+    if (IsIdleService(cur_srv)) {
+      RunStacklessService(std::move(next_srv));
+      return true;
+    }
+
+    this_thread_data_->stackless_service = std::move(next_srv);
+    next_srv = this_thread_data_->main_service;
+    SetServiceStatus(next_srv.get(), ServiceStatus::kReady);
+  }
+
+  if (!SwitchTo(cur_srv, std::move(next_srv)))
+    return false;
+
+  if (IsIdleService(cur_srv) && this_thread_data_->stackless_service)
+    RunStacklessService(std::move(this_thread_data_->stackless_service));
+  return true;
 }
 
-bool System::SwitchTo(ServicePtr &&cur_srv, ServicePtr &&next_srv) {
+// the switch in and out is only bookkeeping, the handlers are called here
+void System::RunStacklessService(ServicePtr srv) {
+  auto *const ptd = this_thread_data_;
+  ServicePtr idle_srv = std::move(ptd->current_service);
+  LOG_TRACE << "run stackless " << srv->name();
+  OnWorkerBusy();
+  TraceSwitch(idle_srv.get(), srv.get());
+  ChargeRunTime(idle_srv.get(), srv.get());
+  ptd->current_service = std::move(srv);
+  OnResume(ptd->current_service, ptd->prev_service);
+
+  HandleStacklessMessages(ptd->current_service);
+
+  srv = std::move(ptd->current_service);
+  TraceSwitch(srv.get(), idle_srv.get());
+  ChargeRunTime(srv.get(), idle_srv.get());
+  ptd->current_service = std::move(idle_srv);
+}
+
+// MessageDrivenServiceMain without the waits: the service gives the worker
+// back once its mailbox is empty, or its budget is used up
+void System::HandleStacklessMessages(const ServicePtr &srv) {
+  auto *const srv_context = srv->context();
+  auto *const msg_driven_srv_ptr = static_cast<MessageDrivenService *>(srv.get());
+  if (!srv_context->started) {
+    srv_context->started = true;
+    srv->OnServiceStart();
+  }
+
+  auto &mailbox = srv_context->mailbox;
+  auto &batch = this_thread_data_->stackless_batch;
+  const size_t max_batch_size = msg_driven_srv_ptr->MaxBatchSize();
+  auto drain_mailbox = [&]() {
+    while (mailbox.PopBatch(&batch, max_batch_size) > 0) {
+      ServiceContext::Charge(&srv_context->messages_handled, batch.size());
+      WakeupMailboxSpaceWaiters(srv.get());
+      msg_driven_srv_ptr->HandleMessages(Span<const MessagePtr>(batch));
+      batch.clear();
+      if (srv_context->execution_budget != 0 &&
+          srv_context->budget_used >= srv_context->execution_budget) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  const ServiceEvent wait_events = ServiceEvent::kMessage | ServiceEvent::kServiceStop;
+  while (true) {
+    const bool drained = drain_mailbox();
+    if (srv_context->stopping.load())
+      break;
+
+    if (!drained) {
+      // the mailbox stays scheduled, so no sender wakes it up meanwhile
+      std::lock_guard<std::mutex> gl(srv_context->mutex);
+      srv_context->budget_yields.fetch_add(1, std::memory_order_relaxed);
+      SetServiceStatus(srv.get(), ServiceStatus::kReady);
+      PutReadyService(srv);
+      return;
+    }
+
+    if (!mailbox.Unschedule())
+      continue;
+
+    std::lock_guard<std::mutex> gl(srv_context->mutex);
+    if (srv_context->stopping.load(std::memory_order_relaxed))
+      break;
+
+    // woken before it got here, as in Wait_Locked
+    if (srv_context->events & wait_events) {
+      srv_context->events &= ~wait_events;
+      continue;
+    }
+
+    SetServiceStatus(srv.get(), ServiceStatus::kBlocked);
+    srv_context->wait_events = wait_events;
+    TraceWait(srv.get(), wait_events);
+    return;
+  }
+
+  // the messages accepted before closing are still handled
+  mailbox.Close();
+  WakeupMailboxSpaceWaiters(srv.get());
+  while (!drain_mailbox()) {
+  }
+
+  srv->OnServiceStop();
+  CHECK(mailbox.Empty());
+  LOG_TRACE << srv->name() << " stopping";
+
+  std::lock_guard<std::mutex> gl(srv_context->mutex);
+  SetServiceStatus(srv.get(), ServiceStatus::kDead);
+  RemoveService(srv->handle());
+}
+
+// the services are moved between current_service and prev_service, so no
+// reference count is touched on the way
+bool System::SwitchTo(Service *cur_srv, ServicePtr &&next_srv) {
   ServiceContext::ContextType *next_ucontext_ptr = nullptr;
   ServiceContext::ContextType *save_ucontext_ptr = nullptr;
   {
-    if (cur_srv == next_srv)
+    if (cur_srv == next_srv.get())
       return false;
 
     assert(cur_srv);
     assert(next_srv);
     LOG_TRACE << "switch from " << cur_srv->name() << " to " << next_srv->name();
+    if (IsIdleService(cur_srv))
+      OnWorkerBusy();
+    TraceSwitch(cur_srv, next_srv.get());
+    ChargeRunTime(cur_srv, next_srv.get());
     assert(this_thread_data_);
-    CHECK(cur_srv == this_thread_data_->current_service);
+    CHECK(cur_srv == this_thread_data_->current_service.get());
 
     {
       cur_srv->context()->is_swaping_out = true;
@@ -194,13 +452,17 @@ bool System::SwitchTo(ServicePtr &&cur_srv, ServicePtr &&next_srv) {
 
       save_ucontext_ptr = &cur_srv->context()->ucontext;
       next_ucontext_ptr = &next_srv->context()->ucontext;
+      // the stack bytes of a shared stack service are copied in first
+      if (next_srv->context()->shared_stack &&
+          this_thread_data_->stack_owner.get() != next_srv.get())
+        next_ucontext_ptr = &this_thread_data_->switcher_context;
+      this_thread_data_->prev_service = std::move(this_thread_data_->current_service);
       this_thread_data_->current_service = std::move(next_srv);
-      this_thread_data_->prev_service = std::move(cur_srv);
     }
   }
 
   jump_fcontext(save_ucontext_ptr, *next_ucontext_ptr, reinterpret_cast<intptr_t>(this),
-                true);
+                preserve_fpu());
 
   CHECK(this_thread_data_->current_service);
   OnResume(this_thread_data_->current_service, this_thread_data_->prev_service);
@@ -219,13 +481,18 @@ void System::OnResume(ServicePtr &cur_srv, ServicePtr &prev_srv) {
     if (!IsIdleService(prev_srv.get())) {
       if (prev_srv->context()->wakeup_signal && ServiceIsBlocked(prev_srv.get())) {
         SetServiceStatus(prev_srv.get(), ServiceStatus::kReady);
-        PutReadyService(prev_srv);
+        PutReadyService(std::move(prev_srv));
       }
     }
   }
   {
     std::lock_guard<std::mutex> gl(cur_srv->context()->mutex);
-    cur_srv->context()->last_thread_index_ = this_thread_data_->thread_index;
+    auto const last_thread_index = cur_srv->context()->last_thread_index_;
+    if (last_thread_index != this_thread_data_->thread_index) {
+      if (last_thread_index != -1)
+        ++cur_srv->context()->migrations;
+      cur_srv->context()->last_thread_index_ = this_thread_data_->thread_index;
+    }
     CHECK_EQ(cur_srv->context()->is_swaping_out, false);
     CHECK(cur_srv->context()->status == ServiceStatus::kReady);
 
@@ -235,12 +502,43 @@ void System::OnResume(ServicePtr &cur_srv, ServicePtr &prev_srv) {
   }
   cur_srv->context()->wakeup_time.store(timer_srv_.GetCurrentTime(),
                                         std::memory_order_relaxed);
+  cur_srv->context()->budget_used = 0;
 }
 
 void System::ThreadMain(int thread_index) {
   CHECK(nullptr == this_thread_data_);
-  this_thread_data_ = &perthread_data_[static_cast<size_t>(thread_index)];
+  auto &slot = perthread_data_[static_cast<size_t>(thread_index)];
+  if (slot) {
+    // the slot of a retired worker, peers may still look at it
+    slot->retiring.store(false);
+    slot->exited.store(false);
+    slot->local_ready_queue.open();
+  } else {
+    slot.reset(new PerthreadData);
+    if (sharded_) {
+      slot->shard_rings.resize(static_cast<size_t>(max_workers_));
+      for (auto &ring : slot->shard_rings) {
+        ring.reset(new concurrence::waitfree::SPSCRing<ServicePtr>(kShardRingCapacity));
+      }
+
+      bool fresh = false;
+      slot->shared_stack =
+          static_cast<uint8_t *>(StackPool::Instance().Allocate(kSharedStackSize, &fresh));
+      slot->switcher_stack =
+          static_cast<uint8_t *>(StackPool::Instance().Allocate(kSwitcherStackSize, &fresh));
+      CHECK(slot->shared_stack && slot->switcher_stack);
+      slot->switcher_context = make_fcontext(slot->switcher_stack + kSwitcherStackSize,
+                                             kSwitcherStackSize, &SharedStackSwitcherMain);
+    }
+  }
+  this_thread_data_ = slot.get();
+  this_thread_data_->system = this;
   this_thread_data_->thread_index = thread_index;
+  this_thread_data_->numa_node = this_thread::NumaNode();
+  this_thread_data_->steal_seed = static_cast<uint32_t>(thread_index) * 2654435761U + 1;
+  this_thread_data_->native_thread = pthread_self();
+  this_thread_data_->running_since.store(0);
+  this_thread_data_->reported_since = 0;
 
   auto msrv = CreateService<IdleService>(this, "IdleService");
   msrv->handle(Handle(idle_service_index_));
@@ -259,16 +557,35 @@ void System::ThreadMain(int thread_index) {
   this_thread_data_->current_service = this_thread_data_->main_service;
   this_thread_data_->prev_service.reset();
 
+  // the peers are looked at when scheduling, they must all exist first
   ++worker_init_num_;
+  while (worker_num_.load() <= thread_index)
+    this_thread::Yield();
+
   jump_fcontext(&this_thread_data_->ucontext,
                 this_thread_data_->current_service->context()->ucontext,
-                reinterpret_cast<intptr_t>(static_cast<void *>(this)), true);
+                reinterpret_cast<intptr_t>(static_cast<void *>(this)), preserve_fpu());
 
   if (this_thread_data_) {
     this_thread_data_->current_service.reset();
     this_thread_data_->prev_service.reset();
     this_thread_data_->main_service.reset();
+    this_thread_data_->handoff_service.reset();
+    this_thread_data_->stackless_service.reset();
     this_thread_data_->local_ready_queue.clear();
+    ServicePtr srv;
+    for (auto &ring : this_thread_data_->shard_rings) {
+      while (ring->Pop(&srv)) {
+      }
+    }
+    this_thread_data_->stack_owner.reset();
+    if (this_thread_data_->shared_stack) {
+      StackPool::Instance().Release(this_thread_data_->shared_stack, kSharedStackSize);
+      StackPool::Instance().Release(this_thread_data_->switcher_stack, kSwitcherStackSize);
+      this_thread_data_->shared_stack = nullptr;
+      this_thread_data_->switcher_stack = nullptr;
+    }
+    this_thread_data_->exited.store(true);
   }
 
   LOG_INFO << "ThreadMain Stop";
@@ -299,7 +616,9 @@ void System::UserThreadServiceMain(intptr_t ptr) {
     std::string sname = cur_srv->name();
     LOG_TRACE << "RetireService " << sname << " refcount " << cur_srv.use_count() - 1;
 
-    cur_srv->context()->msg_queue.empty();
+    cur_srv->context()->mailbox.Close();
+    sys->WakeupMailboxSpaceWaiters(cur_srv.get());
+    sys->RecordStackUsage(cur_srv.get(), true);
     sys->RemoveService(cur_srv->handle());
     cur_srv.reset();
     if (server_stoped) {
@@ -316,6 +635,40 @@ void System::UserThreadServiceMain(intptr_t ptr) {
   CHECK(false);
 }
 
+void System::SharedStackSwitcherMain(intptr_t ptr) {
+  auto *const sys = reinterpret_cast<System *>(ptr);
+  while (true) {
+    sys->SwapSharedStack();
+    auto *const ptd = sys->this_thread_data_;
+    jump_fcontext(&ptd->switcher_context, ptd->current_service->context()->ucontext, ptr,
+                  sys->preserve_fpu());
+  }
+}
+
+// runs on the switcher stack: saves the live bytes of the service on the
+// shared stack, all of them above its saved stack pointer, and puts those of
+// the current service back to the same addresses
+void System::SwapSharedStack() {
+  auto *const ptd = this_thread_data_;
+  uint8_t *const top = ptd->shared_stack + kSharedStackSize;
+
+  auto &owner = ptd->stack_owner;
+  if (owner && owner->context()->status.load() != ServiceStatus::kDead) {
+    auto *const ctx = owner->context();
+    ctx->saved_stack.assign(static_cast<uint8_t *>(ctx->ucontext), top);
+    if (ctx->saved_stack.capacity() > 2 * ctx->saved_stack.size())
+      ctx->saved_stack.shrink_to_fit();
+  }
+
+  auto *const ctx = ptd->current_service->context();
+  if (ctx->ucontext) {
+    memcpy(top - ctx->saved_stack.size(), ctx->saved_stack.data(), ctx->saved_stack.size());
+  } else {
+    ctx->ucontext = make_fcontext(top, kSharedStackSize, ctx->service_main);
+  }
+  owner = ptd->current_service;
+}
+
 void System::MessageDrivenServiceMain(intptr_t ptr) {
   System *sys = nullptr;
   {
@@ -332,47 +685,46 @@ void System::MessageDrivenServiceMain(intptr_t ptr) {
 
     CHECK(msg_driven_srv_ptr);
     sys->SetServiceStatus(cur_srv.get(), ServiceStatus::kRunning);
-    MessagePtr msg;
-    std::unique_lock<std::mutex> unique_lock(srv_context->mutex);
-    while (true) {
-      CHECK(unique_lock.owns_lock());
-      if (!srv_context->msg_queue.empty()) {
-        msg = std::move(srv_context->msg_queue.front());
-        srv_context->msg_queue.pop_front();
-        assert(msg);
-
-        unique_lock.unlock();
-        msg_driven_srv_ptr->HandleMessage(msg);
-        msg.reset();
-        unique_lock.lock();
-      } else {
-        assert(unique_lock.owns_lock());
-        if (srv_context->stopping.load()) {
-          break;
-        }
+    auto &mailbox = srv_context->mailbox;
+    const size_t max_batch_size = msg_driven_srv_ptr->MaxBatchSize();
+    std::vector<MessagePtr> batch;
+    batch.reserve(max_batch_size);
+    auto drain_mailbox = [&]() {
+      while (mailbox.PopBatch(&batch, max_batch_size) > 0) {
+        ServiceContext::Charge(&srv_context->messages_handled, batch.size());
+        sys->WakeupMailboxSpaceWaiters(cur_srv.get());
+        msg_driven_srv_ptr->HandleMessages(Span<const MessagePtr>(batch));
+        batch.clear();
+      }
+    };
 
-        if (!srv_context->wakeup_signal) {
-          ServiceEvent revent = sys->Wait_Locked(
-              cur_srv.get(), ServiceEvent::kMessage | ServiceEvent::kServiceStop,
-              &unique_lock);
-          (void)revent;
-          CHECK(unique_lock.owns_lock());
-          CHECK(revent & (ServiceEvent::kMessage | ServiceEvent::kServiceStop));
-          // CHECK(srv_context->wakeup_signal == false);
-        } else {
-          srv_context->wakeup_signal = false;
-          CHECK(unique_lock.owns_lock());
-        }
+    while (true) {
+      drain_mailbox();
+      if (srv_context->stopping.load()) {
+        // the messages accepted before closing are still handled
+        mailbox.Close();
+        sys->WakeupMailboxSpaceWaiters(cur_srv.get());
+        drain_mailbox();
+        break;
       }
+
+      if (!mailbox.Unschedule())
+        continue;
+
+      std::unique_lock<std::mutex> unique_lock(srv_context->mutex);
+      ServiceEvent revent = sys->Wait_Locked(
+          cur_srv.get(), ServiceEvent::kMessage | ServiceEvent::kServiceStop, &unique_lock);
+      (void)revent;
+      CHECK(revent & (ServiceEvent::kMessage | ServiceEvent::kServiceStop));
     }
 
     cur_srv->OnServiceStop();
-    CHECK(srv_context->msg_queue.empty());
+    CHECK(mailbox.Empty());
     LOG_TRACE << cur_srv->name() << " stopping";
-    // locked
-    CHECK(unique_lock.owns_lock());
     CHECK(srv_context->stopping);
 
+    sys->RecordStackUsage(cur_srv.get(), true);
+    std::unique_lock<std::mutex> unique_lock(srv_context->mutex);
     sys->SetServiceStatus(cur_srv.get(), ServiceStatus::kDead);
     std::string sname = cur_srv->name();
     LOG_TRACE << "RetireService " << sname << " refcount " << cur_srv.use_count() - 1;
@@ -386,27 +738,100 @@ void System::MessageDrivenServiceMain(intptr_t ptr) {
 }
 
 Status System::SendMessage(const MessagePtr &msg) {
+  return SendMessage(msg, false);
+}
+
+Status System::SendMessage(const MessagePtr &msg, bool handoff) {
   auto const h = msg->destination();
   assert(h);
   auto dest_srv = GrabService(h);
+  if (!dest_srv)
+    return Status(kNotFound);
 
-  if (dest_srv) {
-    auto srv_context = dest_srv->context();
-    std::unique_lock<std::mutex> unique_lock(srv_context->mutex);
-    if (srv_context->stopping.load(std::memory_order_relaxed) ||
-        GetServiceStatus(dest_srv.get()) == ServiceStatus::kCreated) {
-      unique_lock.unlock();
-      return Status(kNotFound);
-    }
+  auto srv_context = dest_srv->context();
+  if (srv_context->stopping.load(std::memory_order_relaxed) ||
+      GetServiceStatus(dest_srv.get()) == ServiceStatus::kCreated) {
+    return Status(kNotFound);
+  }
 
-    srv_context->msg_queue.push_back(msg);
-    if (srv_context->wait_events & ServiceEvent::kMessage) {
-      Wakeup_Locked(dest_srv, ServiceEvent::kMessage);
+  auto &mailbox = srv_context->mailbox;
+  const bool drop_oldest = mailbox.overflow_policy() == MailboxOverflowPolicy::kDropOldest;
+  MessagePtr evicted;
+  while (true) {
+    switch (mailbox.Push(msg, drop_oldest ? &evicted : nullptr)) {
+      case Mailbox::kRejected:
+        return Status(kNotFound);
+      case Mailbox::kFull: {
+        if (mailbox.overflow_policy() != MailboxOverflowPolicy::kBlock ||
+            !IsWorkerThread() || CurrentService() == dest_srv ||
+            CurrentService()->context()->stackless) {
+          return Status(kAgain, "mailbox is full");
+        }
+
+        auto status = WaitMailboxSpace(dest_srv);
+        if (!status)
+          return status;
+        continue;
+      }
+      case Mailbox::kScheduled: {
+        // the mailbox was idle, the service may be waiting for it
+        std::lock_guard<std::mutex> gl(srv_context->mutex);
+        Wakeup_Locked(dest_srv, ServiceEvent::kMessage, handoff);
+        break;
+      }
+      case Mailbox::kQueued:
+        break;
     }
-    unique_lock.unlock();
+    break;
+  }
+
+  // a handoff sender blocks right away anyway
+  if (!handoff && IsWorkerThread())
+    ConsumeExecutionBudget(CurrentService().get());
+
+  if (evicted) {
+    LOG_TRACE << "SendMessage: " << dest_srv->name() << " dropped the oldest message";
+    evicted->Done(Status(kAgain, "dropped from the full mailbox"));
+  }
+
+  return Status::OK();
+}
+
+// the sender registers itself and then checks the mailbox, the consumer pops
+// and then checks for waiters, so one of them sees the other
+Status System::WaitMailboxSpace(const ServicePtr &dest_srv) {
+  auto *const dest_context = dest_srv->context();
+  {
+    std::lock_guard<std::mutex> gl(dest_context->mutex);
+    dest_context->mailbox_space_waiters.push_back(CurrentService()->handle());
+    dest_context->has_mailbox_space_waiters.store(true, std::memory_order_seq_cst);
+  }
+
+  if (!dest_context->mailbox.Full())
     return Status::OK();
-  } else {
-    return Status(kNotFound);
+
+  auto revents = Wait(ServiceEvent::kMailboxSpace | ServiceEvent::kServiceStop |
+                      ServiceEvent::kInterrupt);
+  if (revents & ServiceEvent::kMailboxSpace)
+    return Status::OK();
+
+  return Status(kInterrupt);
+}
+
+void System::WakeupMailboxSpaceWaiters(Service *srv) {
+  auto *const srv_context = srv->context();
+  if (!srv_context->has_mailbox_space_waiters.load(std::memory_order_seq_cst))
+    return;
+
+  std::vector<ServiceHandle> waiters;
+  {
+    std::lock_guard<std::mutex> gl(srv_context->mutex);
+    waiters.swap(srv_context->mailbox_space_waiters);
+    srv_context->has_mailbox_space_waiters.store(false, std::memory_order_relaxed);
+  }
+
+  for (auto &h : waiters) {
+    WakeUp(h, ServiceEvent::kMailboxSpace);
   }
 }
 
@@ -431,9 +856,9 @@ uint64_t System::ServiceSleepTime(const Service *srv) {
 }
 
 ServiceEvent System::Wait(ServiceEvent const events) {
-  ServicePtr srv = CurrentService();
+  Service *const srv = CurrentService().get();
   std::unique_lock<std::mutex> unique_lock(srv->context()->mutex);
-  return Wait_Locked(srv.get(), events, &unique_lock);
+  return Wait_Locked(srv, events, &unique_lock);
 }
 
 ServiceEvent System::Wait_Locked(Service *srv, ServiceEvent events,
@@ -442,6 +867,9 @@ ServiceEvent System::Wait_Locked(Service *srv, ServiceEvent events,
 
   CHECK(unique_lock->owns_lock());
   CHECK(CurrentService().get() == srv);
+  // it runs on the idle service's stack, which it cannot switch away from
+  if (srv->context()->stackless)
+    LOG_FATA << "Wait: stackless service " << srv->name() << " must not block";
   CHECK(srv && srv->context()->status == ServiceStatus::kRunning);
   srv->context()->wait_events = 0;
 
@@ -464,6 +892,7 @@ ServiceEvent System::Wait_Locked(Service *srv, ServiceEvent events,
     SetServiceStatus(srv, ServiceStatus::kBlocked);
     srv->context()->is_swaping_out = true;
     srv->context()->wait_events = events;
+    TraceWait(srv, events);
     unique_lock->unlock();
     bool res = Schedule();
     CHECK(res);
@@ -494,7 +923,15 @@ bool System::WakeUp(const ServicePtr &srv, ServiceEvent e) {
   return Wakeup_Locked(srv, e);
 }
 
-bool System::Wakeup_Locked(const ServicePtr &srv, ServiceEvent e) {
+void System::WakeUpWithHandoff(const Handle &h, ServiceEvent e) {
+  auto srv = GrabService(h);
+  if (srv) {
+    std::lock_guard<std::mutex> gl(srv->context()->mutex);
+    Wakeup_Locked(srv, e, true);
+  }
+}
+
+bool System::Wakeup_Locked(const ServicePtr &srv, ServiceEvent e, bool handoff) {
   LOG_TRACE << "wake up " << srv->name() << " with events " << e;
 
   //@note Wakeup may happen before Wait
@@ -503,21 +940,21 @@ bool System::Wakeup_Locked(const ServicePtr &srv, ServiceEvent e) {
   if ((srv->context()->wait_events & e) == 0)
     return false;
 
+  TraceWakeup(srv.get(), e);
   srv->context()->wakeup_signal = true;
   if (srv->context()->is_swaping_out)
     return true;
 
   if (ServiceIsBlocked(srv.get())) {
     SetServiceStatus(srv.get(), ServiceStatus::kReady);
-    PutReadyService(srv);
+    PutReadyService(srv, handoff || scheduling_policy_ == SchedulingPolicy::kLifoSlot);
   }
 
   return true;
 }
 
 Status System::SleepService(uint32_t milliseconds) {
-  ServicePtr srv = CurrentService();
-  assert(srv);
+  Service *const srv = CurrentService().get();
   auto h = srv->handle();
 
   std::unique_lock<std::mutex> ul(srv->context()->mutex);
@@ -525,7 +962,7 @@ Status System::SleepService(uint32_t milliseconds) {
       milliseconds, [h, this]() mutable { this->WakeUp(h, ServiceEvent::kSleep); });
 
   ServiceEvent revents = Wait_Locked(
-      srv.get(),
+      srv,
       ServiceEvent::kSleep | ServiceEvent::kServiceStop | ServiceEvent::kInterrupt, &ul);
   ul.unlock();
   if (revents & ServiceEvent::kSleep) {
@@ -537,16 +974,57 @@ Status System::SleepService(uint32_t milliseconds) {
   }
 }
 
+void System::ConsumeExecutionBudget(Service *srv) {
+  auto *const srv_context = srv->context();
+  if (srv_context->execution_budget == 0 ||
+      ++srv_context->budget_used < srv_context->execution_budget) {
+    return;
+  }
+
+  assert(CurrentService().get() == srv);
+  // a stackless service yields once the current batch is handled
+  if (srv_context->stackless)
+    return;
+
+  srv_context->budget_used = 0;
+  srv_context->budget_yields.fetch_add(1, std::memory_order_relaxed);
+  YieldService();
+}
+
+void System::YieldService() {
+  auto *const ptd = this_thread_data_;
+  Service *const srv = CurrentService().get();
+  if (sharded_)
+    DrainShardRings(ptd);
+  if (srv->context()->stackless)
+    LOG_FATA << "YieldService: stackless service " << srv->name() << " must not yield";
+
+  if (IsIdleService(srv) || (!ptd->handoff_service && ptd->local_ready_queue.empty_unsyn() &&
+                             run_queue_.empty_unsyn()))
+    return;
+
+  {
+    // OnResume requeues the service once it is swapped out
+    std::lock_guard<std::mutex> gl(srv->context()->mutex);
+    SetServiceStatus(srv, ServiceStatus::kBlocked);
+    srv->context()->is_swaping_out = true;
+    srv->context()->wakeup_signal = true;
+  }
+  bool res = Schedule();
+  CHECK(res);
+}
+
 Status System::WaitIO(int fd, unsigned int io_events) {
-  ServicePtr srv = CurrentService();
+  Service *const srv = CurrentService().get();
   LOG_TRACE << "WaitIO: " << srv->name() << " wait io events "
             << IOService::EpollEventText(fd, io_events);
 
+  ServiceContext::Charge(&srv->context()->io_waits, 1);
   std::unique_lock<std::mutex> ul(srv->context()->mutex);
   srv->context()->io_events = 0;
-  if (auto status = GetIOService()->Add(srv.get(), fd, io_events)) {
+  if (auto status = GetIOService()->Add(srv, fd, io_events)) {
     ServiceEvent revents =
-        Wait_Locked(srv.get(), ServiceEvent::kIO_Operation | ServiceEvent::kServiceStop |
+        Wait_Locked(srv, ServiceEvent::kIO_Operation | ServiceEvent::kServiceStop |
                                    ServiceEvent::kInterrupt,
                     &ul);
 
@@ -556,7 +1034,7 @@ Status System::WaitIO(int fd, unsigned int io_events) {
         return Status::OK();
       return Status(kFailed, "WaitIO: io error");
     } else {
-      GetIOService()->Remove(srv.get(), fd);
+      GetIOService()->Remove(srv, fd);
       LOG_INFO << "WaitIO: " << srv->name() << " interrupted by events " << revents;
       return Status(kInterrupt);
     }
@@ -589,23 +1067,608 @@ Status System::WakeupIfWaitTimeout(const Service *srv, uint32_t max_sleeptime_ms
                         max_sleeptime_ms);
 }
 
+Status System::GetServiceStats(const Handle &h, ServiceStats *stats) {
+  auto s = GrabService(h);
+  if (!s)
+    return Status(kNotFound);
+
+  GetServiceStats(s.get(), stats);
+  return Status::OK();
+}
+
+void System::GetServiceStats(const Service *srv, ServiceStats *stats) {
+  stats->name = srv->name();
+  stats->handle = srv->handle();
+
+  std::lock_guard<std::mutex> gl(srv->context()->mutex);
+  stats->migrations = srv->context()->migrations;
+  stats->stack_size = static_cast<uint64_t>(srv->context()->stack_size);
+  stats->mailbox_depth = srv->context()->mailbox.Size();
+  stats->mailbox_high_watermark = srv->context()->mailbox.HighWatermark();
+  stats->mailbox_dropped = srv->context()->mailbox.Dropped();
+  stats->budget_yields = srv->context()->budget_yields.load(std::memory_order_relaxed);
+
+  auto const *const ctx = srv->context();
+  uint64_t run_time = ctx->run_time.load(std::memory_order_relaxed);
+  if (ctx->status.load() == ServiceStatus::kRunning && !ctx->is_swaping_out) {
+    // the current run is charged only when it ends
+    uint64_t const now = Timestamp::Now().count();
+    uint64_t const start = ctx->run_start.load(std::memory_order_relaxed);
+    if (start > 0 && now > start)
+      run_time += now - start;
+  }
+  stats->cpu_time_ns = Timestamp(run_time).ToNonoseconds();
+  stats->switches = ctx->switches.load(std::memory_order_relaxed);
+  stats->messages_handled = ctx->messages_handled.load(std::memory_order_relaxed);
+  stats->io_waits = ctx->io_waits.load(std::memory_order_relaxed);
+  stats->method_calls = ctx->method_calls.load(std::memory_order_relaxed);
+  stats->method_call_time_ns =
+      Timestamp(ctx->method_call_time.load(std::memory_order_relaxed)).ToNonoseconds();
+}
+
+void System::GetAllServiceStats(std::vector<ServiceStats> *stats) {
+  std::vector<ServicePtr> ss;
+  services_.ForEach([&ss](const ServicePtr &s) { ss.push_back(s); });
+  stats->clear();
+  stats->reserve(ss.size());
+  for (auto const &s : ss) {
+    if (IsIdleService(s.get()))
+      continue;
+    stats->emplace_back();
+    GetServiceStats(s.get(), &stats->back());
+  }
+}
+
+void System::ChargeMethodCall(Service *srv, Timestamp start) {
+  auto *const ctx = srv->context();
+  ServiceContext::Charge(&ctx->method_calls, 1);
+  ServiceContext::Charge(&ctx->method_call_time, Timestamp::Now().count() - start.count());
+}
+
+uint64_t System::ReclaimIdleStacks(uint32_t idle_ms) {
+  std::vector<ServicePtr> ss;
+  services_.ForEach([&ss](const ServicePtr &s) { ss.push_back(s); });
+
+  uint64_t reclaimed = 0;
+  for (auto const &s : ss) {
+    if (ServiceSleepTime(s.get()) < idle_ms)
+      continue;
+
+    // a blocked service no longer swapping out has its context saved, and it
+    // is not resumed while the lock is held
+    auto *const ctx = s->context();
+    std::lock_guard<std::mutex> gl(ctx->mutex);
+    if (ctx->status.load() != ServiceStatus::kBlocked || ctx->is_swaping_out || !ctx->stack)
+      continue;
+
+    auto const low = reinterpret_cast<uintptr_t>(ctx->stack);
+    auto const unused_top =
+        reinterpret_cast<uintptr_t>(ctx->ucontext) & ~static_cast<uintptr_t>(kPageSize - 1);
+    if (unused_top <= low)
+      continue;
+
+    // the paint below the stack pointer goes with the pages
+    if (ctx->stack_painted) {
+      ctx->ScanStackHighWater();
+      ctx->stack_reclaimed = true;
+    }
+    if (madvise(ctx->stack, unused_top - low, MADV_DONTNEED) == 0)
+      reclaimed += unused_top - low;
+  }
+  return reclaimed;
+}
+
+void System::GetStackUsage(std::vector<StackUsageStats> *usage) {
+  std::vector<ServicePtr> ss;
+  services_.ForEach([&ss](const ServicePtr &s) { ss.push_back(s); });
+  for (auto const &s : ss) {
+    // a blocked service no longer swapping out does not touch its stack
+    // while the lock is held, see ReclaimIdleStacks
+    std::lock_guard<std::mutex> gl(s->context()->mutex);
+    auto const status = s->context()->status.load();
+    if ((status == ServiceStatus::kBlocked && !s->context()->is_swaping_out) ||
+        status == ServiceStatus::kCreated) {
+      RecordStackUsage(s.get(), false);
+    }
+  }
+
+  usage->clear();
+  std::lock_guard<std::mutex> gl(stack_usage_mutex_);
+  for (auto const &entry : stack_usage_) {
+    usage->push_back(entry.second);
+    if (stack_auto_sizing_) {
+      usage->back().auto_stack_size = static_cast<uint64_t>(
+          AutoStackSize(entry.second.high_water, static_cast<int>(entry.second.stack_size)));
+    }
+  }
+}
+
+int System::StackSizeFor(const std::string &name, int stack_size) {
+  if (!stack_auto_sizing_)
+    return stack_size;
+
+  std::lock_guard<std::mutex> gl(stack_usage_mutex_);
+  auto const it = stack_usage_.find(name);
+  if (it == stack_usage_.end())
+    return stack_size;
+  return AutoStackSize(it->second.high_water, stack_size);
+}
+
+// the sizes are powers of two from kSmallStackSize up to stack_size, so the
+// StackPool keeps a few sizes in use and reuses their stacks
+int System::AutoStackSize(uint64_t high_water, int stack_size) const {
+  if (high_water == 0)
+    return stack_size;
+
+  uint64_t const needed = high_water + stack_margin_;
+  uint64_t size = kSmallStackSize;
+  while (size < needed && size < static_cast<uint64_t>(stack_size))
+    size *= 2;
+  return static_cast<int>(std::min(size, static_cast<uint64_t>(stack_size)));
+}
+
+void System::RecordStackUsage(Service *srv, bool exited) {
+  auto *const ctx = srv->context();
+  if (!ctx->stack_painted || IsIdleService(srv))
+    return;
+
+  uint64_t const high_water = ctx->ScanStackHighWater();
+  std::lock_guard<std::mutex> gl(stack_usage_mutex_);
+  auto &usage = stack_usage_[srv->name()];
+  usage.name = srv->name();
+  usage.exited += exited ? 1 : 0;
+  usage.stack_size = std::max(usage.stack_size, static_cast<uint64_t>(ctx->stack_size));
+  usage.high_water = std::max(usage.high_water, high_water);
+}
+
+// the idle services are not accounted, their time is the workers' idle time
+void System::ChargeRunTime(Service *cur_srv, Service *next_srv) {
+  uint64_t const now = Timestamp::Now().count();
+  if (!IsIdleService(cur_srv)) {
+    auto *const ctx = cur_srv->context();
+    ServiceContext::Charge(&ctx->run_time, now - ctx->run_start.load(std::memory_order_relaxed));
+  }
+  // running_since is cleared while running_service changes, so the watchdog
+  // never pairs a service with the start of another one's run
+  auto *const ptd = this_thread_data_;
+  ptd->running_since.store(0, std::memory_order_relaxed);
+  if (!IsIdleService(next_srv)) {
+    next_srv->context()->run_start.store(now, std::memory_order_relaxed);
+    ServiceContext::Charge(&next_srv->context()->switches, 1);
+    ptd->running_service.store(next_srv->handle().index(), std::memory_order_release);
+    ptd->running_since.store(now, std::memory_order_release);
+  }
+}
+
 ServicePtr System::GetReadyService() {
+  assert(this_thread_data_);
+  auto *const ptd = this_thread_data_;
   ServicePtr srv;
-  if (!run_queue_.pop(&srv)) {
-    assert(this_thread_data_);
-    srv = this_thread_data_->main_service;
-    SetServiceStatus(srv.get(), ServiceStatus::kReady);
+
+  if (sharded_)
+    DrainShardRings(ptd);
+
+  if (ptd->handoff_service) {
+    // a handoff does not jump ahead of a higher priority
+    int const level = static_cast<int>(GetServicePriority(ptd->handoff_service.get()));
+    if (++ptd->handoffs <= kMaxHandoffs && ptd->local_ready_queue.top_unsyn() >= level &&
+        run_queue_.top_unsyn() >= level) {
+      return std::move(ptd->handoff_service);
+    }
+
+    auto const priority = GetServicePriority(ptd->handoff_service.get());
+    ptd->local_ready_queue.push(std::move(ptd->handoff_service), priority);
+  }
+  ptd->handoffs = 0;
+
+  // check the global queue once in a while, otherwise services woken by
+  // non-worker threads would starve behind a busy local queue. a higher
+  // priority waiting there goes first anyway.
+  if ((++ptd->schedule_tick % kGlobalQueueCheckInterval == 0 ||
+       run_queue_.top_unsyn() < ptd->local_ready_queue.top_unsyn()) &&
+      !run_queue_.empty_unsyn() && run_queue_.pop(&srv)) {
+    return srv;
   }
+
+  if (ptd->local_ready_queue.pop(&srv))
+    return srv;
+
+  if (!run_queue_.empty_unsyn() && run_queue_.pop(&srv))
+    return srv;
+
+  srv = ptd->main_service;
+  SetServiceStatus(srv.get(), ServiceStatus::kReady);
   return srv;
 }
 
-void System::PutReadyService(const ServicePtr &srv) {
+// the service's context mutex is locked by the caller. with handoff the
+// service skips the queues and takes the LIFO slot of this worker, it runs
+// next once the caller blocks(CallMethod) or yields(SchedulingPolicy::kLifoSlot),
+// so no other worker is woken up for it
+void System::PutReadyService(ServicePtr srv, bool handoff) {
   if (srv->handle().index() == idle_service_index_)
     return;
 
-  run_queue_.push(srv);
+  if (sharded_) {
+    PutShardReadyService(std::move(srv), handoff);
+    return;
+  }
+
+  PerthreadData *const local =
+      IsWorkerThread() && !this_thread_data_->retiring.load(std::memory_order_relaxed)
+          ? this_thread_data_
+          : nullptr;
+  if (handoff && local && !stopped.load(std::memory_order_relaxed)) {
+    std::swap(local->handoff_service, srv);
+    if (!srv)
+      return;
+    // an earlier handoff is queued as usual
+  }
+
+  PerthreadData *target = local;
+  auto const last_thread_index = srv->context()->last_thread_index_;
+  // when stopping, peers may already have exited
+  if (service_affinity_ && last_thread_index >= 0 && last_thread_index < WorkerCount() &&
+      !stopped.load(std::memory_order_relaxed)) {
+    // keep the service on the worker whose cache still holds its stack and
+    // data, unless that worker is much busier than this one
+    auto *const last = perthread_data_[static_cast<size_t>(last_thread_index)].get();
+    size_t const local_size = local ? local->local_ready_queue.size_unsyn() : 0;
+    if (last == local ||
+        last->local_ready_queue.size_unsyn() <= local_size + kAffinityImbalance) {
+      target = last;
+    }
+  }
+
+  auto const priority = GetServicePriority(srv.get());
+  if (target && target == local) {
+    target->local_ready_queue.push(std::move(srv), priority);
+  } else if (!target || !target->local_ready_queue.try_push(std::move(srv), priority)) {
+    // the last worker of the service may have been retired meanwhile
+    target = nullptr;
+    run_queue_.push(std::move(srv), priority);
+  }
+  UnparkWorker(target == local ? nullptr : target);
+}
+
+// sharded: the service only runs on its own shard. a worker passes it to
+// another shard through their SPSC ring, other threads and a full ring use the
+// locked local_ready_queue of the shard.
+void System::PutShardReadyService(ServicePtr srv, bool handoff) {
+  auto *const target = perthread_data_[static_cast<size_t>(srv->context()->shard)].get();
+  PerthreadData *const local = IsWorkerThread() ? this_thread_data_ : nullptr;
+  auto const priority = GetServicePriority(srv.get());
+  if (target == local) {
+    if (handoff && !stopped.load(std::memory_order_relaxed)) {
+      std::swap(local->handoff_service, srv);
+      if (!srv)
+        return;
+    }
+    local->local_ready_queue.push(std::move(srv), priority);
+    return;
+  }
+
+  if (!local ||
+      !target->shard_rings[static_cast<size_t>(local->thread_index)]->Push(std::move(srv))) {
+    target->local_ready_queue.push(std::move(srv), priority);
+  }
+  UnparkWorker(target);
+}
+
+void System::DrainShardRings(PerthreadData *ptd) {
+  ServicePtr srv;
+  for (auto &ring : ptd->shard_rings) {
+    while (ring->Pop(&srv)) {
+      auto const priority = GetServicePriority(srv.get());
+      ptd->local_ready_queue.push(std::move(srv), priority);
+    }
+  }
+}
+
+bool System::ShardHasReadyServices(PerthreadData *ptd) {
+  if (!ptd->local_ready_queue.empty())
+    return true;
+
+  for (auto &ring : ptd->shard_rings) {
+    if (!ring->Empty())
+      return true;
+  }
+
+  return false;
+}
+
+bool System::NeedSchedule() {
+  if (!run_queue_.empty())
+    return true;
+
+  int const n = WorkerCount();
+  for (int i = 0; i < n; ++i) {
+    auto *const ptd = perthread_data_[static_cast<size_t>(i)].get();
+    if (sharded_ ? ShardHasReadyServices(ptd) : !ptd->local_ready_queue.empty())
+      return true;
+  }
+
+  return false;
+}
+
+// called by the idle service when there is nothing to run: steals half of the
+// ready services of a randomly chosen peer. a peer with a single ready service
+// is likely to run it soon itself, so it is left alone for the first rounds to
+// keep the service on its cache-warm worker.
+bool System::RebalanceReadyQueue(int idle_rounds) {
+  assert(this_thread_data_);
+  auto *const ptd = this_thread_data_;
+  const size_t n = static_cast<size_t>(WorkerCount());
+  if (n < 2 || sharded_ || ptd->retiring.load(std::memory_order_relaxed))
+    return false;
+
+  // xorshift32
+  ptd->steal_seed ^= ptd->steal_seed << 13;
+  ptd->steal_seed ^= ptd->steal_seed >> 17;
+  ptd->steal_seed ^= ptd->steal_seed << 5;
+
+  const size_t start = ptd->steal_seed % n;
+  const size_t min_victim_size =
+      service_affinity_ && idle_rounds < kStealSingleAfterRounds ? 2 : 1;
+  // with numa_aware, the first pass only looks at workers on this node and the
+  // second one at the others
+  const int passes = !numa_aware_ ? 1 : idle_rounds < kStealRemoteAfterRounds ? 1 : 2;
+  for (size_t i = 0; i < n * static_cast<size_t>(passes); ++i) {
+    auto &victim = *perthread_data_[(start + i) % n];
+    if (&victim == ptd || victim.local_ready_queue.size_unsyn() < min_victim_size)
+      continue;
+
+    if (numa_aware_ && (victim.numa_node == ptd->numa_node) != (i < n))
+      continue;
+
+    if (victim.local_ready_queue.popHalf(&ptd->steal_buffer) > 0) {
+      LOG_TRACE << "worker " << ptd->thread_index << " stole "
+                << ptd->steal_buffer.size() << " services from worker "
+                << victim.thread_index;
+      for (auto &srv : ptd->steal_buffer) {
+        auto const priority = GetServicePriority(srv.get());
+        ptd->local_ready_queue.push(std::move(srv), priority);
+      }
+      ptd->steal_buffer.clear();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void System::OnWorkerBusy() {
+  auto *const ptd = this_thread_data_;
+  if (ptd->spinning) {
+    ptd->spinning = false;
+    spinning_workers_.fetch_sub(1);
+  }
+}
+
+void System::ParkWorker() {
+  auto *const ptd = this_thread_data_;
+  OnWorkerBusy();
+
+  ptd->parked.store(1);
+  parked_workers_.fetch_add(1);
+
+  // a service made ready concurrently is either seen here, or its
+  // PutReadyService sees parked_workers_ > 0 and unparks a worker
+  // a shard only runs its own services
+  if (this_thread::IsInterrupted() || ptd->retiring.load() ||
+      (sharded_ ? ShardHasReadyServices(ptd) : NeedSchedule())) {
+    if (ptd->parked.exchange(0) == 1)
+      parked_workers_.fetch_sub(1);
+    return;
+  }
+
+  LOG_TRACE << "worker " << ptd->thread_index << " parked";
+  while (ptd->parked.load() == 1) {
+    FutexWait(&ptd->parked, 1);
+  }
+}
+
+// wakes up the preferred worker if it is parked, otherwise one parked worker
+// unless some worker is already spinning, the spinning one will find the new
+// service.
+void System::UnparkWorker(PerthreadData *preferred) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (parked_workers_.load(std::memory_order_relaxed) == 0)
+    return;
+
+  if (preferred) {
+    int parked = 1;
+    if (preferred->parked.load(std::memory_order_relaxed) == 1 &&
+        preferred->parked.compare_exchange_strong(parked, 0)) {
+      parked_workers_.fetch_sub(1);
+      FutexWake(&preferred->parked, 1);
+      return;
+    }
+  }
+
+  // no other worker can run a shard's services
+  if (sharded_ || spinning_workers_.load(std::memory_order_relaxed) > 0)
+    return;
+
+  int const n = WorkerCount();
+  for (int i = 0; i < n; ++i) {
+    auto *const ptd = perthread_data_[static_cast<size_t>(i)].get();
+    int parked = 1;
+    if (ptd->parked.load(std::memory_order_relaxed) == 1 &&
+        ptd->parked.compare_exchange_strong(parked, 0)) {
+      parked_workers_.fetch_sub(1);
+      FutexWake(&ptd->parked, 1);
+      return;
+    }
+  }
+}
+
+void System::UnparkAllWorkers() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int const n = WorkerCount();
+  for (int i = 0; i < n; ++i) {
+    auto *const ptd = perthread_data_[static_cast<size_t>(i)].get();
+    if (ptd->parked.exchange(0) == 1) {
+      parked_workers_.fetch_sub(1);
+      FutexWake(&ptd->parked, 1);
+    }
+  }
 }
 
-void System::RebalanceReadyQueue() {}
+// elastic mode: adds a worker when services keep waiting while every worker is
+// busy, retires the last worker when it stays parked. UnparkWorker prefers the
+// first parked workers, so the last one is the idlest.
+void System::ResizeWorkers() {
+  std::lock_guard<std::mutex> gl(workers_mutex_);
+  if (stopped.load())
+    return;
+
+  int const n = WorkerCount();
+  size_t queued = run_queue_.size_unsyn();
+  for (int i = 0; i < n; ++i) {
+    queued += perthread_data_[static_cast<size_t>(i)]->local_ready_queue.size_unsyn();
+  }
+
+  if (queued > kGrowQueueDepth * static_cast<size_t>(n) &&
+      spinning_workers_.load() == 0 && parked_workers_.load() == 0) {
+    idle_checks_ = 0;
+    if (++busy_checks_ >= kGrowAfterChecks && n < max_workers_) {
+      busy_checks_ = 0;
+      AddWorker();
+    }
+  } else {
+    busy_checks_ = 0;
+    if (n > min_workers_ && perthread_data_[static_cast<size_t>(n - 1)]->parked.load() == 1) {
+      if (static_cast<uint32_t>(++idle_checks_) * kResizeIntervalMs >= worker_idle_timeout_ms_) {
+        idle_checks_ = 0;
+        RetireWorker();
+      }
+    } else {
+      idle_checks_ = 0;
+    }
+  }
+
+  resize_timer_ = timer_srv_.AddTimer(kResizeIntervalMs, [this]() { ResizeWorkers(); });
+}
+
+void System::AddWorker() {
+  int const i = WorkerCount();
+  auto &thread = threads_[kFirstWorkerThread + static_cast<size_t>(i)];
+  if (perthread_data_[static_cast<size_t>(i)]) {
+    // the worker retired from this slot may still be running its services
+    if (!perthread_data_[static_cast<size_t>(i)]->exited.load())
+      return;
+    thread.Join();
+  }
+
+  int const inited = worker_init_num_.load();
+  thread = StartWorker(i);
+  while (worker_init_num_.load() == inited)
+    this_thread::Yield();
+  workers_added_.fetch_add(1, std::memory_order_relaxed);
+  worker_num_.store(i + 1);
+
+  LOG_INFO << "System: worker " << i << " added";
+}
+
+// the last worker leaves the pool at once, the services already queued on it
+// are run by it before it exits, new ones go to the other workers
+void System::RetireWorker() {
+  int const i = WorkerCount() - 1;
+  auto *const ptd = perthread_data_[static_cast<size_t>(i)].get();
+  workers_retired_.fetch_add(1, std::memory_order_relaxed);
+  worker_num_.store(i);
+  ptd->local_ready_queue.close();
+  ptd->retiring.store(true);
+  if (ptd->parked.exchange(0) == 1) {
+    parked_workers_.fetch_sub(1);
+    FutexWake(&ptd->parked, 1);
+  }
+  LOG_INFO << "System: worker " << i << " retired";
+}
+
+void System::RecordTrace(TraceEventType type, int64_t service, int64_t other,
+                         uint32_t events) {
+  if (IsWorkerThread()) {
+    tracer_.worker_buffer(this_thread_data_->thread_index)
+        ->Record(type, service, other, events);
+  } else {
+    tracer_.RecordOther(type, service, other, events);
+  }
+}
+
+void System::RecordWakeup(const Service *srv, ServiceEvent events) {
+  int64_t const waker = IsWorkerThread() ? CurrentService()->handle().index() : -1;
+  RecordTrace(TraceEventType::kWakeup, srv->handle().index(), waker, events);
+}
+
+Status System::WriteChromeTrace(std::ostream &os) {
+  if (!tracing_)
+    return Status(kFailed, "WriteChromeTrace: tracing is off");
+
+  tracer_.WriteChromeTrace(
+      os,
+      [this](int64_t index) {
+        if (index == idle_service_index_)
+          return std::string("idle");
+        auto srv = FindService(Handle(index));
+        return srv ? srv->name() : "service " + std::to_string(index);
+      },
+      idle_service_index_);
+  return Status::OK();
+}
+
+Status System::WriteChromeTrace(const std::string &path) {
+  std::ofstream ofs(path);
+  if (!ofs)
+    return Status(kFailed, "WriteChromeTrace: can not open " + path);
+
+  auto status = WriteChromeTrace(ofs);
+  if (status && !ofs.flush())
+    return Status(kFailed, "WriteChromeTrace: write error " + path);
+  return status;
+}
+
+void System::CheckStalledWorkers() {
+  std::lock_guard<std::mutex> gl(workers_mutex_);
+  if (stopped.load())
+    return;
+
+  uint64_t const now = Timestamp::Now().count();
+  int const n = WorkerCount();
+  for (int i = 0; i < n; ++i) {
+    auto *const ptd = perthread_data_[static_cast<size_t>(i)].get();
+    uint64_t const since = ptd->running_since.load(std::memory_order_acquire);
+    int64_t const index = ptd->running_service.load(std::memory_order_acquire);
+    if (since == 0 || since != ptd->running_since.load(std::memory_order_relaxed) ||
+        since == ptd->reported_since || now <= since)
+      continue;
+
+    uint64_t const held_ms = Timestamp(now - since).ToMilliseconds();
+    if (held_ms < watchdog_threshold_ms_)
+      continue;
+
+    // a stall is reported once
+    ptd->reported_since = since;
+    stalls_.fetch_add(1, std::memory_order_relaxed);
+    auto srv = FindService(Handle(index));
+    LOG_WARN << "watchdog: service " << (srv ? srv->name() : std::string("(gone)"))
+             << ", handle " << index << " has held worker " << i << " for " << held_ms
+             << "ms without switching out";
+    if (watchdog_backtrace_)
+      pthread_kill(ptd->native_thread, WatchdogSignal());
+  }
+
+  watchdog_timer_ = timer_srv_.AddTimer(WatchdogInterval(), [this]() { CheckStalledWorkers(); });
+}
+
+void System::GetWorkerPoolStats(WorkerPoolStats *stats) {
+  stats->workers = WorkerCount();
+  stats->min_workers = min_workers_;
+  stats->max_workers = max_workers_;
+  stats->workers_added = workers_added_.load(std::memory_order_relaxed);
+  stats->workers_retired = workers_retired_.load(std::memory_order_relaxed);
+  stats->stalls = stalls_.load(std::memory_order_relaxed);
+}
 
 }  // namespace mcast
@@ -3,14 +3,18 @@
 
 #include <ctype.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
+#include <stdlib.h>
 
+#include <algorithm>
 #include <functional>
 #include <future>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
+#include <new>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -18,20 +22,45 @@
 
 #include "util/Logging.h"
 #include "util/Noncopyable.h"
+#include "util/SPSCQueue.h"
 #include "util/Status.h"
 
 #include "Closure.h"
 #include "IOService.h"
 #include "Message.h"
+#include "ReadyQueue.h"
 #include "Service.h"
 #include "ServiceContext.h"
+#include "ServiceOptions.h"
+#include "ServicePool.h"
+#include "ServiceStats.h"
+#include "ServiceTable.h"
+#include "StartOptions.h"
 #include "TimerService.h"
+#include "Tracer.h"
 
 namespace mcast {
 
 class IOService;
 class WakeupService;
 
+// where a worker queues a service woken by the service it is running
+enum class SchedulingPolicy {
+  kFifo,      // at the tail of a ready queue
+  kLifoSlot,  // in the worker's LIFO slot, the woken service runs as soon as
+              // the waker blocks or yields. a newer wakeup takes the slot and
+              // queues the older one, and the slot does not run ahead of a
+              // higher priority or more than kMaxHandoffs times in a row
+};
+
+// what a context switch saves beside the callee-saved registers
+enum class SwitchPolicy {
+  kPreserveFpu,  // also the x87 control word and the MXCSR, so a service
+                 // may set its own rounding mode or exception masks
+  kNoFpu,        // not them, the services share the FPU control state of
+                 // the workers and none may change it
+};
+
 class System : public Noncopyable {
  public:
   typedef Service::Handle Handle;
@@ -40,6 +69,10 @@ class System : public Noncopyable {
   constexpr static int kNormalStackSize = 1024 * 1024;
   constexpr static int kLargeStackSize = 4 * 1024 * 1024;
   constexpr static int kVeryLargeStackSize = 8 * 1024 * 1024;
+  // the stack shared by the ServiceOptions::shared_stack services of a worker
+  constexpr static int kSharedStackSize = kNormalStackSize;
+  constexpr static uint32_t kDefaultStackMargin = 16 * 1024;
+  constexpr static uint32_t kDefaultExecutionBudget = 64;
 
   template <typename T>
   using BasicHandle = Service::BasicHandle<T>;
@@ -49,10 +82,62 @@ class System : public Noncopyable {
     Stop();
   }
 
-  Status Start(int worker_num_hint = 0);
+  Status Start(int worker_num_hint = 0) {
+    StartOptions options;
+    options.worker_num = worker_num_hint;
+    return Start(options);
+  }
+
+  Status Start(const StartOptions& options);
   void Stop();
   void WaitStop();
 
+  // when enabled(the default), idle workers spin for a while and then sleep
+  // until new services are ready, otherwise they keep spinning. must be called
+  // before Start.
+  void SetIdleParking(bool enable) {
+    idle_parking_ = enable;
+  }
+
+  // when enabled(the default), a woken service is queued on the worker which
+  // ran it last time, unless that worker is much busier than the waker. must
+  // be called before Start.
+  void SetServiceAffinity(bool enable) {
+    service_affinity_ = enable;
+  }
+
+  // kFifo by default, must be called before Start
+  void SetSchedulingPolicy(SchedulingPolicy policy) {
+    scheduling_policy_ = policy;
+  }
+
+  // kPreserveFpu by default. The policy holds for every switch of the
+  // System: a context saved without the FPU state cannot be resumed with it.
+  // must be called before Start
+  void SetSwitchPolicy(SwitchPolicy policy) {
+    switch_policy_ = policy;
+  }
+
+  bool preserve_fpu() const {
+    return switch_policy_ == SwitchPolicy::kPreserveFpu;
+  }
+
+  bool numa_aware() const {
+    return numa_aware_;
+  }
+
+  bool sharded() const {
+    return sharded_;
+  }
+
+  // the number of operations(socket reads and writes, sent messages) a
+  // service runs before it yields to other ready services, 0 means
+  // unlimited. ServiceOptions::execution_budget overrides it per service.
+  // must be called before Start.
+  void SetExecutionBudget(uint32_t ops) {
+    execution_budget_ = ops;
+  }
+
   template <typename Service, typename... Args>
   BasicHandle<Service> LaunchService(Args&&... args) {
     return LaunchService<Service, kNormalStackSize>(std::forward<Args>(args)...);
@@ -64,13 +149,52 @@ class System : public Noncopyable {
     return LaunchService<ServiceType, StackSize>(std::move(sptr));
   }
 
+  template <typename ServiceType, int StackSize = kNormalStackSize, typename... Args>
+  BasicHandle<ServiceType> LaunchServiceWithOptions(const ServiceOptions& options,
+                                                    Args&&... args) {
+    auto sptr = CreateService<ServiceType>(this, std::forward<Args>(args)...);
+    return LaunchService<ServiceType, StackSize>(std::move(sptr), options);
+  }
+
   template <typename ServiceType, int StackSize = kNormalStackSize>
-  BasicHandle<ServiceType> LaunchService(BasicServicePtr<ServiceType>&& s);
+  BasicHandle<ServiceType> LaunchService(BasicServicePtr<ServiceType>&& s,
+                                         const ServiceOptions& options = ServiceOptions());
+
+  // launches n services of the same type with the same arguments, member i
+  // on shard i of a sharded System. returns an empty pool if one fails or n
+  // is not positive. The calls to an empty pool return kNotFound
+  template <typename ServiceType, int StackSize = kNormalStackSize, typename... Args>
+  ServicePool<ServiceType> LaunchServicePool(int n, const Args&... args);
+
+  template <typename T>
+  void StopServicePool(const ServicePool<T>& pool) {
+    for (auto& h : pool.members()) {
+      StopService(h);
+    }
+  }
 
   template <typename ServiceType, typename... FunArgs, typename... Args>
   Status CallMethod(const Handle& dest_service, void (ServiceType::*func)(FunArgs...),
                     Args&&... args);
 
+  // a pool member is chosen by the hash of key, or round robin without a key
+  template <typename T, typename Key, typename ServiceType, typename... FunArgs,
+            typename... Args>
+  Status CallMethod(const ServicePool<T>& pool, const Key& key,
+                    void (ServiceType::*func)(FunArgs...), Args&&... args) {
+    if (!pool)
+      return Status(kNotFound, "empty service pool");
+    return CallMethod(pool.Route(key), func, std::forward<Args>(args)...);
+  }
+
+  template <typename T, typename ServiceType, typename... FunArgs, typename... Args>
+  Status CallMethod(const ServicePool<T>& pool, void (ServiceType::*func)(FunArgs...),
+                    Args&&... args) {
+    if (!pool)
+      return Status(kNotFound, "empty service pool");
+    return CallMethod(pool.Next(), func, std::forward<Args>(args)...);
+  }
+
   template <typename ServiceType, typename... FunArgs, typename... Args>
   Status CallMethodWithClosure(const Handle& dest_service,
                                void (ServiceType::*func)(FunArgs...), Args&&... args);
@@ -83,11 +207,44 @@ class System : public Noncopyable {
   Status AsyncCallMethod(const Handle& dest_service,
                          void (ServiceType::*func)(FunArgs...), Args&&... args);
 
+  template <typename T, typename Key, typename ServiceType, typename... FunArgs,
+            typename... Args>
+  Status AsyncCallMethod(const ServicePool<T>& pool, const Key& key,
+                         void (ServiceType::*func)(FunArgs...), Args&&... args) {
+    if (!pool)
+      return Status(kNotFound, "empty service pool");
+    return AsyncCallMethod(pool.Route(key), func, std::forward<Args>(args)...);
+  }
+
+  template <typename T, typename ServiceType, typename... FunArgs, typename... Args>
+  Status AsyncCallMethod(const ServicePool<T>& pool, void (ServiceType::*func)(FunArgs...),
+                         Args&&... args) {
+    if (!pool)
+      return Status(kNotFound, "empty service pool");
+    return AsyncCallMethod(pool.Next(), func, std::forward<Args>(args)...);
+  }
+
+  // calls func on every member of the pool one after another, returns the
+  // first error
+  template <typename T, typename ServiceType, typename... FunArgs, typename... Args>
+  Status BroadcastCallMethod(const ServicePool<T>& pool,
+                             void (ServiceType::*func)(FunArgs...), const Args&... args);
+
+  // sends func to every member of the pool, returns the first error
+  template <typename T, typename ServiceType, typename... FunArgs, typename... Args>
+  Status AsyncBroadcastCallMethod(const ServicePool<T>& pool,
+                                  void (ServiceType::*func)(FunArgs...), const Args&... args);
+
+  // with a bounded mailbox returns kAgain when it is full, unless the
+  // overflow policy is kBlock and the caller is a service, which then waits
   Status SendMessage(const MessagePtr& msg);
   Status SendStringMessage(const Handle& dest_service, const std::string& text,
                            const Message::Closure& done);
 
   Status SleepService(uint32_t milliseconds);
+  void YieldService();
+  void ConsumeExecutionBudget(Service* srv);
+  void ChargeMethodCall(Service* srv, Timestamp start);
   uint64_t ServiceSleepTime(const Service* srv);  // milliseconds
 
   template <typename T>
@@ -128,6 +285,70 @@ class System : public Noncopyable {
   Status WakeupIfWaitTimeout(const Handle& h, uint32_t max_sleeptime_ms);
   Status WakeupIfWaitTimeout(const Service* srv, uint32_t max_sleeptime_ms);
 
+  Status GetServiceStats(const Handle& h, ServiceStats* stats);
+  void GetServiceStats(const Service* srv, ServiceStats* stats);
+
+  // a snapshot of the stats of every service, for top-like tools
+  void GetAllServiceStats(std::vector<ServiceStats>* stats);
+
+  // gives back the stack pages below the stack pointer of the services
+  // blocked for at least idle_ms, returns the bytes given back. a service
+  // going deeper later faults zeroed pages in again
+  uint64_t ReclaimIdleStacks(uint32_t idle_ms);
+
+  // the number of running workers, it changes over time in elastic mode
+  int WorkerCount() const {
+    return worker_num_.load(std::memory_order_acquire);
+  }
+
+  void GetWorkerPoolStats(WorkerPoolStats* stats);
+
+  // keeps the latest events_per_thread scheduler events(switches, wakeups,
+  // blocking waits) of every thread, see Tracer. 0, the default, turns
+  // tracing off. must be called before Start
+  void SetTracing(size_t events_per_thread) {
+    trace_events_ = events_per_thread;
+  }
+
+  // the watchdog logs the services holding a worker for over threshold_ms
+  // without switching out, with backtrace it also makes the stalled worker
+  // print its stack to stderr, on a handler for SIGRTMIN + 1 installed from
+  // Start to Stop. 0 turns it off. must be called before Start
+  void SetWatchdog(uint32_t threshold_ms, bool backtrace = false) {
+    watchdog_threshold_ms_ = threshold_ms;
+    watchdog_backtrace_ = backtrace;
+  }
+
+  // fills each new service stack with a pattern, so the deepest use of the
+  // stacks can be found, see GetStackUsage. Every page of a painted stack
+  // is touched, it is for sizing runs. must be called before Start
+  void SetStackPainting(bool enable) {
+    stack_painting_ = enable;
+  }
+
+  bool stack_painting() const {
+    return stack_painting_;
+  }
+
+  // LaunchService gives a service the deepest stack use seen for its name
+  // plus margin bytes, rounded up to a power of two from kSmallStackSize,
+  // instead of its StackSize once one was measured. It never gives more than
+  // the StackSize. implies stack painting. must be called before Start
+  void SetStackAutoSizing(bool enable, uint32_t margin = kDefaultStackMargin) {
+    stack_auto_sizing_ = enable;
+    stack_margin_ = margin;
+    if (enable)
+      stack_painting_ = true;
+  }
+
+  // the stack use per service name, of the services measured at their exit
+  // and of the blocked ones, which are scanned now
+  void GetStackUsage(std::vector<StackUsageStats>* usage);
+
+  // writes the trace in the Chrome trace event format, also after Stop
+  Status WriteChromeTrace(std::ostream& os);
+  Status WriteChromeTrace(const std::string& path);
+
   IOService* GetIOService() {
     return &io_srv_;
   }
@@ -155,37 +376,95 @@ class System : public Noncopyable {
   }
 
  private:
+  struct PerthreadData;
+
   void OnIOReady(ServicePtr& srv, int fd, unsigned int io_events);
 
+  // with handoff, a callee woken by the message runs next on this worker
+  Status SendMessage(const MessagePtr& msg, bool handoff);
+  void WakeUpWithHandoff(const Handle& h, ServiceEvent e);
+
+  Status WaitMailboxSpace(const ServicePtr& dest_srv);
+  void WakeupMailboxSpaceWaiters(Service* srv);
+
   size_t ServiceMessageQueueSize(const Service* srv) {
-    std::lock_guard<std::mutex> ul(srv->context()->mutex);
-    return srv->context()->msg_queue.size();
+    return static_cast<size_t>(srv->context()->mailbox.Size());
   }
 
-  ServicePtr CurrentService() {
+  // valid until the current service is switched out
+  const ServicePtr& CurrentService() {
     assert(this_thread_data_ && this_thread_data_->current_service);
     return this_thread_data_->current_service;
   }
 
   template <typename ServiceType, int StackSize>
   ServiceContextPtr CreateServiceContext(ServiceType* s, void (*ServiceMain)(intptr_t)) {
-    return ServiceContext::Create(s, this, StackSize, ServiceMain);
+    return ServiceContext::Create(s, this, StackSizeFor(s->name(), StackSize), ServiceMain);
   }
 
+  // stack painting: the stack size auto sizing picks, and the merging of a
+  // measured stack into the usage of its name
+  int StackSizeFor(const std::string& name, int stack_size);
+  int AutoStackSize(uint64_t high_water, int stack_size) const;
+  void RecordStackUsage(Service* srv, bool exited);
+
   ServiceEvent Wait(ServiceEvent event);
   ServiceEvent Wait_Locked(Service* srv, ServiceEvent event,
                            std::unique_lock<std::mutex>* unique_lock);
 
   void ThreadMain(int thread_index);
+  Thread StartWorker(int thread_index);
+
+  // elastic mode, run by the timer thread
+  void ResizeWorkers();
+  void AddWorker();
+  void RetireWorker();
+
+  // run by the timer thread
+  void CheckStalledWorkers();
+
+  uint32_t WatchdogInterval() const {
+    return std::max<uint32_t>(1, watchdog_threshold_ms_ / 2);
+  }
 
   static void MessageDrivenServiceMain(intptr_t);
   static void UserThreadServiceMain(intptr_t);
 
+  // shared stack mode: a switch to a service whose bytes are not on the
+  // shared stack goes through the switcher, which copies them on its own stack
+  static void SharedStackSwitcherMain(intptr_t);
+  void SwapSharedStack();
+
+  // stackless mode: runs the handlers of srv on the idle service's stack
+  void RunStacklessService(ServicePtr srv);
+  void HandleStacklessMessages(const ServicePtr& srv);
+
+  // the tracing hooks cost a single branch when tracing is off
+  void TraceSwitch(const Service* from, const Service* to) {
+    if (tracing_)
+      RecordTrace(TraceEventType::kSwitch, to->handle().index(), from->handle().index(), 0);
+  }
+
+  void TraceWakeup(const Service* srv, ServiceEvent events) {
+    if (tracing_)
+      RecordWakeup(srv, events);
+  }
+
+  void TraceWait(const Service* srv, ServiceEvent events) {
+    if (tracing_)
+      RecordTrace(TraceEventType::kWait, srv->handle().index(), -1, events);
+  }
+
+  void RecordTrace(TraceEventType type, int64_t service, int64_t other, uint32_t events);
+  void RecordWakeup(const Service* srv, ServiceEvent events);
+
+  void ChargeRunTime(Service* cur_srv, Service* next_srv);
+
   bool SwitchToNext();
-  bool SwitchTo(ServicePtr&& cur_srv, ServicePtr&& next_srv);
+  bool SwitchTo(Service* cur_srv, ServicePtr&& next_srv);
   void OnResume(ServicePtr& cur_srv, ServicePtr& prev_srv);
 
-  bool Wakeup_Locked(const ServicePtr& srv, ServiceEvent events);
+  bool Wakeup_Locked(const ServicePtr& srv, ServiceEvent events, bool handoff = false);
 
   void SetServiceStatus(const Service* srv, ServiceStatus s) {
     srv->context()->status.store(s, std::memory_order_relaxed);
@@ -200,23 +479,37 @@ class System : public Noncopyable {
     return srv->context()->status.load(std::memory_order_relaxed);
   }
 
+  ServicePriority GetServicePriority(const Service* srv) {
+    return srv->context()->priority;
+  }
+
   void StopAllService();
   Handle::IndexType NewHandleIndex();
 
-  bool NeedSchedule() {
-    return !run_queue_.empty();
+  bool NeedSchedule();
+
+  bool IsWorkerThread() const {
+    return this_thread_data_ && this_thread_data_->system == this;
   }
 
   bool IsIdleService(Service* s) {
     return s->handle().index() == idle_service_index_;
   }
 
+  void ParkWorker();
+  void UnparkWorker(PerthreadData* preferred = nullptr);
+  void UnparkAllWorkers();
+  void OnWorkerBusy();
+
   void StopUnguard();
   Status StartBuitinServices();
 
   ServicePtr GetReadyService();
-  void PutReadyService(const ServicePtr& srv);
-  void RebalanceReadyQueue();
+  void PutReadyService(ServicePtr srv, bool handoff = false);
+  void PutShardReadyService(ServicePtr srv, bool handoff);
+  void DrainShardRings(PerthreadData* ptd);
+  bool ShardHasReadyServices(PerthreadData* ptd);
+  bool RebalanceReadyQueue(int idle_rounds);
 
   void SetServiceFD(const Service* srv, int fd) {
     srv->context()->fd = fd;
@@ -225,49 +518,156 @@ class System : public Noncopyable {
     return srv->context()->fd;
   }
 
-  void AddService(const ServicePtr& s) {
-    std::lock_guard<std::shared_timed_mutex> g(services_shared_mutex_);
-    services_.emplace(s->handle().index(), s);
+  Handle::IndexType AddService(const ServicePtr& s) {
+    return services_.Insert(s);
   }
 
   void RemoveService(ServiceHandle h) {
-    std::lock_guard<std::shared_timed_mutex> g(services_shared_mutex_);
-    services_.erase(h.index());
+    services_.Remove(h.index());
   }
 
   ServicePtr FindService(ServiceHandle h) {
-    {
-      std::shared_lock<std::shared_timed_mutex> g(services_shared_mutex_);
-      auto it = services_.find(h.index());
-      if (it != services_.end())
-        return it->second;
-    }
-
-    return ServicePtr();
+    return services_.Find(h.index());
   }
 
   struct PerthreadData {
+    // the ready queues are cache line aligned, which the global operator new
+    // does not honour before C++17
+    static void* operator new(size_t size) {
+      void* p = nullptr;
+      if (posix_memalign(&p, alignof(PerthreadData), size) != 0)
+        throw std::bad_alloc();
+      return p;
+    }
+
+    static void operator delete(void* p) {
+      free(p);
+    }
+
     ServiceContext::ContextType ucontext;
     ServicePtr main_service;
     ServicePtr current_service;
     ServicePtr prev_service;
-    ThreadSafeQueue<Service*> local_ready_queue;
+    ReadyQueue<ServicePtr> local_ready_queue;
+    ServicePtr handoff_service;  // the LIFO slot, only touched by this worker
+    int handoffs = 0;            // in a row
+    std::vector<ServicePtr> steal_buffer;
+    System* system = nullptr;
     int thread_index = -1;
+    int numa_node = 0;
+    uint32_t schedule_tick = 0;
+    uint32_t steal_seed = 0;
+    int idle_spin_rounds = kMinIdleSpinRounds;
+    bool spinning = false;
+    std::atomic<int> parked{0};  // futex word
+    std::atomic<bool> retiring{false};  // runs its queued services and exits
+    std::atomic<bool> exited{false};
+    // for the watchdog: the running service and when it was switched in, 0
+    // while the idle service runs
+    pthread_t native_thread;
+    std::atomic<int64_t> running_service{-1};
+    std::atomic<uint64_t> running_since{0};
+    uint64_t reported_since = 0;  // the stall logged last, touched by the watchdog
+    // sharded, services made ready by the other shards, by their index
+    std::vector<std::unique_ptr<concurrence::waitfree::SPSCRing<ServicePtr>>> shard_rings;
+    // sharded, the stack of the shared stack services and the service whose
+    // frames are on it
+    uint8_t* shared_stack = nullptr;
+    ServicePtr stack_owner;
+    uint8_t* switcher_stack = nullptr;
+    ServiceContext::ContextType switcher_context = nullptr;
+    // a stackless service picked by another service's Schedule, the idle
+    // service runs it once switched to
+    ServicePtr stackless_service;
+    std::vector<MessagePtr> stackless_batch;
   };
 
-  static thread_local PerthreadData* this_thread_data_;
-  std::vector<PerthreadData> perthread_data_;
-  ThreadSafeQueue<ServicePtr> run_queue_;
+  // services woken by a worker go to its local_ready_queue, services woken by
+  // other threads (io, timer, user threads) go to the global run_queue_
+  static constexpr uint32_t kGlobalQueueCheckInterval = 61;
+
+  // the number of rounds an idle worker looks for work before parking, it is
+  // adapted per worker between the limits
+  static constexpr int kMinIdleSpinRounds = 64;
+  static constexpr int kMaxIdleSpinRounds = 4096;
+
+  // a woken service migrates to the waker's worker when its last worker has
+  // more than this many services queued beyond the waker's
+  static constexpr size_t kAffinityImbalance = 4;
+  static constexpr int kStealSingleAfterRounds = 32;
+
+  // with numa_aware, an idle worker steals from workers on other NUMA nodes
+  // only after this many rounds, it parks after kMinIdleSpinRounds at least
+  static constexpr int kStealRemoteAfterRounds = 48;
 
-  std::shared_timed_mutex services_shared_mutex_;
-  std::unordered_map<Handle::IndexType, ServicePtr> services_;
-  std::atomic<int64_t> service_index_alloc_{16};
+  // services calling each other could hand the worker back and forth forever,
+  // after this many handoffs in a row the local queue goes first
+  static constexpr int kMaxHandoffs = 16;
+
+  // a full shard ring falls back to the locked local_ready_queue
+  static constexpr size_t kShardRingCapacity = 256;
+  static constexpr int kSwitcherStackSize = 64 * 1024;
+
+  // elastic mode checks the load every kResizeIntervalMs, a worker is added
+  // when more than kGrowQueueDepth services per worker were queued and no
+  // worker was idle kGrowAfterChecks times in a row
+  static constexpr uint32_t kResizeIntervalMs = 10;
+  static constexpr size_t kGrowQueueDepth = 2;
+  static constexpr int kGrowAfterChecks = 3;
+
+  // threads_ holds the timer and the io thread, then the worker slots
+  static constexpr size_t kFirstWorkerThread = 2;
+
+  static thread_local PerthreadData* this_thread_data_;
+  // sized for max_workers_ at Start, so it never moves while workers look at
+  // their peers. the running workers are [0, worker_num_), a slot of a retired
+  // worker is kept for the next worker added.
+  std::vector<std::unique_ptr<PerthreadData>> perthread_data_;
+  std::atomic<int> worker_num_{0};
+  ReadyQueue<ServicePtr> run_queue_;
+
+  bool idle_parking_ = true;
+  bool service_affinity_ = true;
+  SchedulingPolicy scheduling_policy_ = SchedulingPolicy::kFifo;
+  SwitchPolicy switch_policy_ = SwitchPolicy::kPreserveFpu;
+  bool numa_aware_ = false;
+  bool sharded_ = false;
+  std::atomic<unsigned> next_shard_{0};
+  uint32_t execution_budget_ = kDefaultExecutionBudget;
+  std::vector<CpuSet> worker_cpus_;
+  int min_workers_ = 0;
+  int max_workers_ = 0;
+  uint32_t worker_idle_timeout_ms_ = 0;
+  int busy_checks_ = 0;  // touched by the timer thread only
+  int idle_checks_ = 0;
+  std::atomic<uint64_t> workers_added_{0};
+  std::atomic<uint64_t> workers_retired_{0};
+  size_t trace_events_ = 0;
+  bool tracing_ = false;
+  Tracer tracer_;
+  uint32_t watchdog_threshold_ms_ = 0;
+  bool watchdog_backtrace_ = false;
+  bool watchdog_handler_installed_ = false;
+  struct sigaction watchdog_prev_action_;  // restored by Stop
+  TimerHandle watchdog_timer_;
+  std::atomic<uint64_t> stalls_{0};
+  bool stack_painting_ = false;
+  bool stack_auto_sizing_ = false;
+  uint32_t stack_margin_ = kDefaultStackMargin;
+  std::mutex stack_usage_mutex_;
+  std::unordered_map<std::string, StackUsageStats> stack_usage_;  // by name
+  std::atomic<int> spinning_workers_{0};
+  std::atomic<int> parked_workers_{0};
+
+  ServiceTable services_;
 
   std::mutex mutex_;
   std::atomic_bool stopped{true};
   std::condition_variable stop_cond_;
   std::atomic_int worker_init_num_{0};
   std::vector<Thread> threads_;
+  std::mutex workers_mutex_;  // the resizing of an elastic pool against Stop
+  TimerHandle resize_timer_;
 
   IOService io_srv_;
   TimerService timer_srv_;
@@ -281,16 +681,33 @@ class System : public Noncopyable {
 };  // class System
 
 template <typename ServiceType, int StackSize>
-BasicHandle<ServiceType> System::LaunchService(BasicServicePtr<ServiceType>&& srv) {
+BasicHandle<ServiceType> System::LaunchService(BasicServicePtr<ServiceType>&& srv,
+                                               const ServiceOptions& options) {
   if (stopped.load(std::memory_order_relaxed))
     return BasicHandle<ServiceType>();
 
+  if (options.shared_stack && !sharded_) {
+    LOG_WARN << "LaunchService: " << srv->name() << ", shared stacks need a sharded System";
+    return BasicHandle<ServiceType>();
+  }
+
+  if (options.stackless &&
+      (options.shared_stack || srv->ServiceType() == ServiceType::kUserThreadService)) {
+    LOG_WARN << "LaunchService: " << srv->name()
+             << ", only a MessageDrivenService with a stack of its own can be stackless";
+    return BasicHandle<ServiceType>();
+  }
+
   auto* mainfunc = srv->ServiceType() == ServiceType::kUserThreadService
                        ? &UserThreadServiceMain
                        : &MessageDrivenServiceMain;
   {
     ServiceContextPtr sctxt =
-        CreateServiceContext<ServiceType, StackSize>(srv.get(), mainfunc);
+        options.stackless
+            ? ServiceContext::CreateStackless(srv.get())
+            : options.shared_stack
+                  ? ServiceContext::CreateShared(srv.get(), mainfunc)
+                  : CreateServiceContext<ServiceType, StackSize>(srv.get(), mainfunc);
 
     if (!sctxt) {
       return BasicHandle<ServiceType>();
@@ -298,16 +715,24 @@ BasicHandle<ServiceType> System::LaunchService(BasicServicePtr<ServiceType>&& sr
     auto const curtime = timer_srv_.GetCurrentTime();
     sctxt->blocked_time.store(curtime, std::memory_order_relaxed);
     sctxt->wakeup_time.store(curtime, std::memory_order_relaxed);
+    sctxt->mailbox.SetCapacity(options.mailbox_capacity, options.overflow_policy);
+    sctxt->priority = options.priority;
+    if (sharded_) {
+      unsigned const shard = options.shard >= 0 ? static_cast<unsigned>(options.shard)
+                                                : next_shard_.fetch_add(1);
+      sctxt->shard = static_cast<int>(shard % static_cast<unsigned>(WorkerCount()));
+    }
+    uint32_t const budget =
+        options.execution_budget == 0 ? execution_budget_ : options.execution_budget;
+    sctxt->execution_budget =
+        budget == ServiceOptions::kUnlimitedExecutionBudget ? 0 : budget;
     srv->SetContext(std::move(sctxt));
   }
 
   ServicePtr srv_ptr(srv.release());
   assert(!srv);
-  const auto h = BasicHandle<ServiceType>(++service_index_alloc_);
-  srv_ptr->handle(h);
-
   std::lock_guard<std::mutex> gl(srv_ptr->context()->mutex);
-  AddService(srv_ptr);
+  const auto h = BasicHandle<ServiceType>(AddService(srv_ptr));
 
   SetServiceStatus(srv_ptr.get(), ServiceStatus::kBlocked);
   if (srv_ptr->ServiceType() == ServiceType::kUserThreadService) {
@@ -320,13 +745,62 @@ BasicHandle<ServiceType> System::LaunchService(BasicServicePtr<ServiceType>&& sr
     }
   } else {
     srv_ptr->context()->wait_events = ServiceEvent::kMessage | ServiceEvent::kServiceStop;
-    assert(srv_ptr->context()->msg_queue.empty());
+    assert(srv_ptr->context()->mailbox.Empty());
   }
 
   LOG_TRACE << "LaunchService " << srv_ptr->name() << " " << h.index();
   return h;
 }
 
+template <typename ServiceType, int StackSize, typename... Args>
+ServicePool<ServiceType> System::LaunchServicePool(int n, const Args&... args) {
+  if (n <= 0) {
+    LOG_WARN << "LaunchServicePool: " << n << " services";
+    return ServicePool<ServiceType>();
+  }
+
+  std::vector<BasicHandle<ServiceType>> members;
+  for (int i = 0; i < n; ++i) {
+    ServiceOptions options;
+    options.shard = i;
+    auto h = LaunchServiceWithOptions<ServiceType, StackSize>(options, args...);
+    if (!h) {
+      for (auto& m : members) {
+        StopService(m);
+      }
+      return ServicePool<ServiceType>();
+    }
+    members.push_back(h);
+  }
+
+  return ServicePool<ServiceType>(std::move(members));
+}
+
+template <typename T, typename ServiceType, typename... FunArgs, typename... Args>
+Status System::BroadcastCallMethod(const ServicePool<T>& pool,
+                                   void (ServiceType::*func)(FunArgs...),
+                                   const Args&... args) {
+  for (auto& h : pool.members()) {
+    auto status = CallMethod(h, func, args...);
+    if (!status)
+      return status;
+  }
+  return Status::OK();
+}
+
+template <typename T, typename ServiceType, typename... FunArgs, typename... Args>
+Status System::AsyncBroadcastCallMethod(const ServicePool<T>& pool,
+                                        void (ServiceType::*func)(FunArgs...),
+                                        const Args&... args) {
+  Status res = Status::OK();
+  for (auto& h : pool.members()) {
+    auto status = AsyncCallMethod(h, func, args...);
+    if (!status && res)
+      res = status;
+  }
+  return res;
+}
+
 template <typename ServiceType, typename... FunArgs, typename... Args>
 Status System::CallMethod(const Handle& dest, void (ServiceType::*func)(FunArgs...),
                           Args&&... args) {
@@ -341,15 +815,20 @@ Status System::CallMethod(const Handle& dest, void (ServiceType::*func)(FunArgs.
   auto const msg = MakeMethodCallMessage(src, dest, func, std::forward<Args>(args)...);
 
   if (src) {
-    msg->SetClosure(
-        [this, src](const Status&) mutable { WakeUp(src, ServiceEvent::kResponse); });
-    auto status = SendMessage(msg);
+    // the caller blocks right away, so the callee and then the caller again
+    // run next on the current worker
+    msg->SetClosure([this, src](const Status&) mutable {
+      WakeUpWithHandoff(src, ServiceEvent::kResponse);
+    });
+    auto status = SendMessage(msg, true);
     if (status) {
       ServiceEvent revents = Wait(ServiceEvent::kResponse);
       CHECK(revents & ServiceEvent::kResponse);
       // when SendMessage return successfully(kOK), this service(src)
       // will be waked up only by kMessage event, this ensures the message
       // will be handled eventually.
+      // a message dropped from a kDropOldest mailbox is done with kAgain
+      return msg->status();
     }
     return status;
   } else {
@@ -366,6 +845,7 @@ Status System::CallMethod(const Handle& dest, void (ServiceType::*func)(FunArgs.
     if (status) {
       std::unique_lock<std::mutex> lk(mutex);
       cvar.wait(lk, [&done] { return done; });
+      return msg->status();
     }
     return status;
   }
@@ -383,36 +863,50 @@ Status System::CallMethodWithClosure(const Handle& dest,
     assert(src);
   }
 
+  // the method runs the closure, unless the message is dropped from a
+  // kDropOldest mailbox, then the message is done with the error instead
   if (src) {
-    CallClosure closure([this, src] { this->WakeUp(src, ServiceEvent::kResponse); });
+    auto wakeup = [this, src] { this->WakeUpWithHandoff(src, ServiceEvent::kResponse); };
+    CallClosure closure(wakeup);
 
     auto const msg =
         MakeMethodCallMessage(src, dest, func, std::forward<Args>(args)..., closure);
-    auto status = SendMessage(msg);
+    msg->SetClosure([wakeup](const Status& s) {
+      if (!s)
+        wakeup();
+    });
+    auto status = SendMessage(msg, true);
     if (status) {
       ServiceEvent revents = Wait(ServiceEvent::kResponse);
       CHECK(revents & ServiceEvent::kResponse);
       // when SendMessage return successfully(kOK), this service(src)
       // will be waked up only by kMessage event, this ensures the message
       // will be handled eventually.
+      return msg->status();
     }
     return status;
   } else {
     std::mutex mutex;
     std::condition_variable cvar;
     bool done = false;
-    CallClosure closure([&cvar, &done, &mutex]() mutable {
+    auto wakeup = [&cvar, &done, &mutex]() {
       std::lock_guard<std::mutex> gl(mutex);
       done = true;
       cvar.notify_one();
-    });
+    };
+    CallClosure closure(wakeup);
 
     auto const msg =
         MakeMethodCallMessage(src, dest, func, std::forward<Args>(args)..., closure);
+    msg->SetClosure([wakeup](const Status& s) {
+      if (!s)
+        wakeup();
+    });
     auto status = SendMessage(msg);
     if (status) {
       std::unique_lock<std::mutex> lk(mutex);
       cvar.wait(lk, [&done] { return done; });
+      return msg->status();
     }
     return status;
   }
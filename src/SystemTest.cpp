@@ -1,8 +1,19 @@
 #include "System.h"
 
+#include <fenv.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "Message.h"
@@ -122,6 +133,1229 @@ TEST_F(SystemTest, MethodCallServiceTestCase) {
   ASSERT_EQ(res_str, "123");
 }
 
+TEST_F(SystemTest, ServiceStatsTestCase) {
+  auto sh = sys.LaunchService<MethodCallServiceTest>("MethodCallServiceTest");
+  ASSERT_TRUE(sh);
+
+  int int_res = 0;
+  const uint64_t calls = 100;
+  for (uint64_t i = 0; i < calls; ++i) {
+    ASSERT_TRUE(sys.CallMethod(sh, &MethodCallServiceTest::foo1, 123, &int_res));
+  }
+
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(sh, &stats));
+  ASSERT_EQ(stats.name, "MethodCallServiceTest");
+  ASSERT_EQ(stats.handle.index(), sh.index());
+  ASSERT_LE(stats.migrations, calls);
+  ASSERT_EQ(stats.method_calls, calls);
+  ASSERT_GE(stats.messages_handled, calls);
+  ASSERT_GE(stats.switches, 1U);
+
+  std::vector<ServiceStats> all;
+  sys.GetAllServiceStats(&all);
+  auto it = std::find_if(all.begin(), all.end(),
+                         [&sh](const ServiceStats& s) { return s.handle.index() == sh.index(); });
+  ASSERT_NE(it, all.end());
+  ASSERT_EQ(it->method_calls, calls);
+
+  sys.StopService(sh);
+  ASSERT_FALSE(sys.GetServiceStats(System::Handle(12345), &stats));
+}
+
+struct SlowServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Spin(int ms) {
+    auto const until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+  }
+};
+
+TEST_F(SystemTest, ServiceCpuTimeTestCase) {
+  auto sh = sys.LaunchService<SlowServiceTest>("SlowServiceTest");
+  ASSERT_TRUE(sh);
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(sys.CallMethod(sh, &SlowServiceTest::Spin, 2));
+  }
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(sh, &stats));
+  ASSERT_EQ(stats.method_calls, 5U);
+  ASSERT_GE(stats.AverageMethodCallNs(), 1000000U);
+  ASSERT_GE(stats.cpu_time_ns, 8000000U);
+  ASSERT_EQ(stats.io_waits, 0U);
+}
+
+struct WhereServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Where(std::thread::id* id) {
+    *id = std::this_thread::get_id();
+  }
+
+  void Flag(std::atomic<bool>* ran) {
+    *ran = true;
+  }
+};
+
+struct AffinityCallerTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  uint64_t Migrations(BasicHandle<WhereServiceTest> peer) {
+    ServiceStats stats;
+    EXPECT_TRUE(system()->GetServiceStats(peer, &stats));
+    return stats.migrations;
+  }
+
+  // the peer runs on this worker, woken by each call from it
+  void CallHere(BasicHandle<WhereServiceTest> peer, int calls, uint64_t* before,
+                uint64_t* after) {
+    // the idle workers park meanwhile. the handoffs below wake none of them
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::thread::id id;
+    ASSERT_TRUE(system()->CallMethod(peer, &WhereServiceTest::Where, &id));
+    *before = Migrations(peer);
+    for (int i = 0; i < calls; ++i) {
+      ASSERT_TRUE(system()->CallMethod(peer, &WhereServiceTest::Where, &id));
+      ASSERT_EQ(id, std::this_thread::get_id());
+    }
+    *after = Migrations(peer);
+  }
+
+  // the peer is queued on this worker, which stays busy until an idle worker
+  // stole and ran it
+  void StrandHere(BasicHandle<WhereServiceTest> peer, std::atomic<bool>* ran,
+                  uint64_t* before) {
+    std::thread::id id;
+    do {
+      ASSERT_TRUE(system()->CallMethod(peer, &WhereServiceTest::Where, &id));
+    } while (id != std::this_thread::get_id());
+    *before = Migrations(peer);
+
+    ASSERT_TRUE(system()->AsyncCallMethod(peer, &WhereServiceTest::Flag, ran));
+    while (!ran->load()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+};
+
+TEST(SystemStartTest, ServiceAffinityTestCase) {
+  System sys;
+  sys.SetServiceAffinity(true);
+  sys.SetSchedulingPolicy(SchedulingPolicy::kLifoSlot);
+  ASSERT_TRUE(sys.Start(4));
+  auto wh = sys.LaunchService<WhereServiceTest>("WhereServiceTest");
+  auto ch = sys.LaunchService<AffinityCallerTest>("AffinityCallerTest");
+  ASSERT_TRUE(wh);
+  ASSERT_TRUE(ch);
+
+  uint64_t before = 0;
+  uint64_t after = 0;
+  ASSERT_TRUE(sys.CallMethod(ch, &AffinityCallerTest::CallHere, wh, 1000, &before, &after));
+  ASSERT_EQ(after, before);
+  sys.Stop();
+}
+
+TEST(SystemStartTest, StealMigrationTestCase) {
+  // in FIFO order the woken service is queued, where idle workers steal it
+  System sys;
+  sys.SetServiceAffinity(true);
+  ASSERT_TRUE(sys.Start(2));
+  auto wh = sys.LaunchService<WhereServiceTest>("WhereServiceTest");
+  auto ch = sys.LaunchService<AffinityCallerTest>("AffinityCallerTest");
+  ASSERT_TRUE(wh);
+  ASSERT_TRUE(ch);
+
+  uint64_t before = 0;
+  std::atomic<bool> ran{false};
+  ASSERT_TRUE(sys.CallMethod(ch, &AffinityCallerTest::StrandHere, wh, &ran, &before));
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(wh, &stats));
+  ASSERT_EQ(stats.migrations, before + 1);
+  sys.Stop();
+}
+
+struct DeepStackServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Touch(size_t bytes, int* res) {
+    char buf[512 * 1024];
+    memset(buf, 1, std::min(bytes, sizeof buf));
+    *res = static_cast<volatile char*>(buf)[bytes / 2];
+  }
+};
+
+TEST_F(SystemTest, ReclaimIdleStacksTestCase) {
+  auto sh = sys.LaunchService<DeepStackServiceTest>("DeepStackServiceTest");
+  ASSERT_TRUE(sh);
+  int res = 0;
+  ASSERT_TRUE(sys.CallMethod(sh, &DeepStackServiceTest::Touch, size_t(400 * 1024), &res));
+  ASSERT_EQ(res, 1);
+
+  // not blocked for long enough yet
+  ASSERT_EQ(sys.ReclaimIdleStacks(60000), 0U);
+  this_thread::SleepFor(std::chrono::milliseconds(100));
+  ASSERT_GE(sys.ReclaimIdleStacks(20), 400U * 1024);
+
+  ASSERT_TRUE(sys.CallMethod(sh, &DeepStackServiceTest::Touch, size_t(400 * 1024), &res));
+  ASSERT_EQ(res, 1);
+}
+
+struct MidStackServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Touch(size_t bytes, int* res) {
+    char buf[192 * 1024];
+    memset(buf, 1, std::min(bytes, sizeof buf));
+    *res = static_cast<volatile char*>(buf)[bytes / 2];
+  }
+};
+
+static bool FindStackUsage(System* sys, const std::string& name, StackUsageStats* usage) {
+  std::vector<StackUsageStats> all;
+  sys->GetStackUsage(&all);
+  for (auto& u : all) {
+    if (u.name == name) {
+      *usage = u;
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST(SystemStartTest, StackAutoSizingTestCase) {
+  System sys;
+  sys.SetStackAutoSizing(true);
+  ASSERT_TRUE(sys.Start(1));
+  auto sh = sys.LaunchService<MidStackServiceTest>("MidStackServiceTest");
+  ASSERT_TRUE(sh);
+  int res = 0;
+  ASSERT_TRUE(sys.CallMethod(sh, &MidStackServiceTest::Touch, size_t(1024), &res));
+
+  // the service is scanned once blocked, it may still be running after the
+  // reply woke this thread
+  StackUsageStats usage;
+  while (!FindStackUsage(&sys, "MidStackServiceTest", &usage)) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(usage.exited, 0U);
+  ASSERT_EQ(usage.stack_size, uint64_t{System::kNormalStackSize});
+  ASSERT_GE(usage.high_water, 192U * 1024);
+  ASSERT_LT(usage.high_water, usage.stack_size);
+
+  // rounded up to a size class, not to a page
+  ASSERT_GE(usage.auto_stack_size, usage.high_water + System::kDefaultStackMargin);
+  ASSERT_EQ(usage.auto_stack_size, 2U * System::kSmallStackSize);
+
+  ASSERT_TRUE(sys.StopService(sh));
+  ServiceStats stats;
+  while (sys.GetServiceStats(sh, &stats)) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  ASSERT_TRUE(FindStackUsage(&sys, "MidStackServiceTest", &usage));
+  ASSERT_EQ(usage.exited, 1U);
+
+  // the next one gets the learned size, which is enough for it
+  sh = sys.LaunchService<MidStackServiceTest>("MidStackServiceTest");
+  ASSERT_TRUE(sh);
+  ASSERT_TRUE(sys.GetServiceStats(sh, &stats));
+  ASSERT_EQ(stats.stack_size, usage.auto_stack_size);
+  ASSERT_TRUE(sys.CallMethod(sh, &MidStackServiceTest::Touch, size_t(1024), &res));
+  ASSERT_EQ(res, 1);
+
+  // a service with no learned size yet gets its StackSize
+  auto other = sys.LaunchService<MethodCallServiceTest>("MethodCallServiceTest");
+  ASSERT_TRUE(other);
+  ASSERT_TRUE(sys.GetServiceStats(other, &stats));
+  ASSERT_EQ(stats.stack_size, uint64_t{System::kNormalStackSize});
+  sys.Stop();
+}
+
+static bool SignalHandled(int sig) {
+  struct sigaction sa;
+  sigaction(sig, nullptr, &sa);
+  return sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN;
+}
+
+TEST(SystemStartTest, WatchdogTestCase) {
+  System sys;
+  sys.SetWatchdog(20, true);
+  ASSERT_FALSE(SignalHandled(SIGRTMIN + 1));
+  ASSERT_TRUE(sys.Start(2));
+  ASSERT_TRUE(SignalHandled(SIGRTMIN + 1));
+  ASSERT_FALSE(SignalHandled(SIGURG));
+  auto sh = sys.LaunchService<SlowServiceTest>("SlowServiceTest");
+  ASSERT_TRUE(sh);
+
+  ASSERT_TRUE(sys.CallMethod(sh, &SlowServiceTest::Spin, 5));
+  WorkerPoolStats stats;
+  sys.GetWorkerPoolStats(&stats);
+  ASSERT_EQ(stats.stalls, 0U);
+
+  // one stall, reported once however long it lasts
+  ASSERT_TRUE(sys.CallMethod(sh, &SlowServiceTest::Spin, 150));
+  sys.GetWorkerPoolStats(&stats);
+  ASSERT_EQ(stats.stalls, 1U);
+  sys.Stop();
+
+  // the handler it replaced is back
+  ASSERT_FALSE(SignalHandled(SIGRTMIN + 1));
+}
+
+struct CounterServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Add(int n) {
+    total += n;
+  }
+
+  void Get(int* res) {
+    *res = total;
+  }
+
+  int total = 0;
+};
+
+struct MapServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Put(int key, int value) {
+    map[key] = value;
+  }
+
+  void Get(int key, int* value) {
+    auto it = map.find(key);
+    *value = it != map.end() ? it->second : -1;
+  }
+
+  void AddSize(size_t* total) {
+    *total += map.size();
+  }
+
+  std::map<int, int> map;
+};
+
+TEST_F(SystemTest, ServicePoolTestCase) {
+  auto pool = sys.LaunchServicePool<MapServiceTest>(4, "MapServiceTest");
+  ASSERT_TRUE(pool);
+  ASSERT_EQ(pool.size(), 4U);
+
+  // the calls with a key reach the member holding it
+  const int keys = 100;
+  for (int k = 0; k < keys; ++k) {
+    ASSERT_TRUE(sys.AsyncCallMethod(pool, k, &MapServiceTest::Put, k, k * 2));
+  }
+  for (int k = 0; k < keys; ++k) {
+    int value = 0;
+    ASSERT_TRUE(sys.CallMethod(pool, k, &MapServiceTest::Get, k, &value));
+    ASSERT_EQ(value, k * 2);
+  }
+
+  size_t total = 0;
+  ASSERT_TRUE(sys.BroadcastCallMethod(pool, &MapServiceTest::AddSize, &total));
+  ASSERT_EQ(total, static_cast<size_t>(keys));
+
+  // round robin spreads the calls evenly
+  auto counters = sys.LaunchServicePool<CounterServiceTest>(4, "CounterServiceTest");
+  ASSERT_TRUE(counters);
+  for (int i = 0; i < 8; ++i) {
+    ASSERT_TRUE(sys.AsyncCallMethod(counters, &CounterServiceTest::Add, 1));
+  }
+  ASSERT_TRUE(sys.AsyncBroadcastCallMethod(counters, &CounterServiceTest::Add, 10));
+  for (size_t i = 0; i < counters.size(); ++i) {
+    int n = 0;
+    ASSERT_TRUE(sys.CallMethod(counters[i], &CounterServiceTest::Get, &n));
+    ASSERT_EQ(n, 12);
+  }
+
+  sys.StopServicePool(pool);
+  sys.StopServicePool(counters);
+
+  // an empty pool reports the calls instead of routing them
+  auto empty = sys.LaunchServicePool<CounterServiceTest>(0, "CounterServiceTest");
+  ASSERT_FALSE(empty);
+  ASSERT_EQ(empty.size(), 0U);
+  int n = 0;
+  ASSERT_TRUE(sys.CallMethod(empty, &CounterServiceTest::Get, &n).IsNotFound());
+  ASSERT_TRUE(sys.CallMethod(empty, 1, &CounterServiceTest::Get, &n).IsNotFound());
+  ASSERT_TRUE(sys.AsyncCallMethod(empty, &CounterServiceTest::Add, 1).IsNotFound());
+  ASSERT_TRUE(sys.AsyncCallMethod(empty, 1, &CounterServiceTest::Add, 1).IsNotFound());
+  ASSERT_TRUE(sys.BroadcastCallMethod(empty, &CounterServiceTest::Add, 1));
+  sys.StopServicePool(empty);
+}
+
+struct SenderServiceTest : public UserThreadService {
+  SenderServiceTest(System* sys, const std::string& name,
+                    BasicHandle<CounterServiceTest> counter, int messages,
+                    std::atomic<int>* finished)
+      : UserThreadService(sys, name),
+        counter_(counter),
+        messages_(messages),
+        finished_(finished) {}
+
+  void Main() override {
+    for (int i = 0; i < messages_; ++i) {
+      ASSERT_TRUE(system()->AsyncCallMethod(counter_, &CounterServiceTest::Add, 1));
+    }
+    ++*finished_;
+  }
+
+  BasicHandle<CounterServiceTest> counter_;
+  int messages_;
+  std::atomic<int>* finished_;
+};
+
+TEST_F(SystemTest, ManySendersTestCase) {
+  auto ch = sys.LaunchService<CounterServiceTest>("CounterServiceTest");
+  ASSERT_TRUE(ch);
+
+  const int senders = 8;
+  const int messages = 2000;
+  std::atomic<int> finished{0};
+  for (int i = 0; i < senders; ++i) {
+    ASSERT_TRUE(sys.LaunchService<SenderServiceTest>("SenderServiceTest", ch, messages,
+                                                     &finished));
+  }
+
+  while (finished.load() != senders) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // every Add was queued before Get
+  int total = 0;
+  ASSERT_TRUE(sys.CallMethod(ch, &CounterServiceTest::Get, &total));
+  ASSERT_EQ(total, senders * messages);
+}
+
+struct BudgetSenderTest : public UserThreadService {
+  BudgetSenderTest(System* sys, const std::string& name,
+                   BasicHandle<CounterServiceTest> counter, int messages, ServiceStats* stats,
+                   Test_Task* tt)
+      : UserThreadService(sys, name),
+        counter_(counter),
+        messages_(messages),
+        stats_(stats),
+        test_task(tt) {}
+
+  void Main() override {
+    for (int i = 0; i < messages_; ++i) {
+      ASSERT_TRUE(system()->AsyncCallMethod(counter_, &CounterServiceTest::Add, 1));
+    }
+    system()->GetServiceStats(this, stats_);
+    test_task->Done();
+  }
+
+  BasicHandle<CounterServiceTest> counter_;
+  int messages_;
+  ServiceStats* stats_;
+  Test_Task* test_task = nullptr;
+};
+
+TEST_F(SystemTest, ExecutionBudgetTestCase) {
+  auto ch = sys.LaunchService<CounterServiceTest>("CounterServiceTest");
+  ASSERT_TRUE(ch);
+
+  // every 4th message uses up the budget
+  ServiceOptions options;
+  options.execution_budget = 4;
+  ServiceStats stats;
+  ASSERT_TRUE(sys.LaunchServiceWithOptions<BudgetSenderTest>(options, "BudgetSenderTest", ch,
+                                                             100, &stats, &test_task));
+  test_task.Wait();
+  ASSERT_EQ(stats.budget_yields, 25U);
+
+  test_task.Reset();
+  options.execution_budget = ServiceOptions::kUnlimitedExecutionBudget;
+  ASSERT_TRUE(sys.LaunchServiceWithOptions<BudgetSenderTest>(options, "BudgetSenderTest", ch,
+                                                             100, &stats, &test_task));
+  test_task.Wait();
+  ASSERT_EQ(stats.budget_yields, 0U);
+
+  int total = 0;
+  ASSERT_TRUE(sys.CallMethod(ch, &CounterServiceTest::Get, &total));
+  ASSERT_EQ(total, 200);
+}
+
+struct BatchServiceTest : public MethodCallService {
+  BatchServiceTest(System* sys, const std::string& name, size_t max_batch_size)
+      : MethodCallService(sys, name) {
+    SetMaxBatchSize(max_batch_size);
+  }
+
+  void HandleMessages(Span<const MessagePtr> msgs) override {
+    ASSERT_LE(msgs.size(), MaxBatchSize());
+    ++batches;
+    MethodCallService::HandleMessages(msgs);
+  }
+
+  void Add(int n) {
+    total += n;
+  }
+
+  void Get(int* res, int* nbatches) {
+    *res = total;
+    *nbatches = batches;
+  }
+
+  int total = 0;
+  int batches = 0;
+};
+
+TEST_F(SystemTest, BatchServiceTestCase) {
+  auto bh = sys.LaunchService<BatchServiceTest>("BatchServiceTest", 8);
+  ASSERT_TRUE(bh);
+
+  const int messages = 1000;
+  for (int i = 0; i < messages; ++i) {
+    ASSERT_TRUE(sys.AsyncCallMethod(bh, &BatchServiceTest::Add, 1));
+  }
+
+  int total = 0;
+  int batches = 0;
+  ASSERT_TRUE(sys.CallMethod(bh, &BatchServiceTest::Get, &total, &batches));
+  ASSERT_EQ(total, messages);
+  ASSERT_GE(batches, (messages + 1 + 7) / 8);
+  ASSERT_LE(batches, messages + 1);
+}
+
+// handles one message at a time, Hold blocks it until signaled so that the
+// test can fill its mailbox
+struct BoundedServiceTest : public MethodCallService {
+  BoundedServiceTest(System* sys, const std::string& name) : MethodCallService(sys, name) {
+    SetMaxBatchSize(1);
+  }
+
+  void Hold() {
+    WaitSignal();
+  }
+
+  void Add(int n) {
+    total += n;
+  }
+
+  void Get(int* res) {
+    *res = total;
+  }
+
+  int total = 0;
+};
+
+static void WaitMailboxDepth(System* sys, const System::Handle& h, uint64_t depth) {
+  ServiceStats stats;
+  do {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    sys->GetServiceStats(h, &stats);
+  } while (stats.mailbox_depth != depth);
+}
+
+static System::BasicHandle<BoundedServiceTest> LaunchHeldService(
+    System* sys, const ServiceOptions& options) {
+  auto bh = sys->LaunchServiceWithOptions<BoundedServiceTest>(options, "BoundedServiceTest");
+  if (!bh || !sys->AsyncCallMethod(bh, &BoundedServiceTest::Hold))
+    return System::BasicHandle<BoundedServiceTest>();
+
+  // Hold is popped and handled alone
+  WaitMailboxDepth(sys, bh, 0);
+  return bh;
+}
+
+TEST_F(SystemTest, BoundedMailboxTestCase) {
+  ServiceOptions options;
+  options.mailbox_capacity = 4;
+  auto bh = LaunchHeldService(&sys, options);
+  ASSERT_TRUE(bh);
+
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(sys.AsyncCallMethod(bh, &BoundedServiceTest::Add, 1));
+  }
+  ASSERT_TRUE(sys.AsyncCallMethod(bh, &BoundedServiceTest::Add, 1).IsAgain());
+
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(bh, &stats));
+  ASSERT_EQ(stats.mailbox_depth, 4U);
+  ASSERT_EQ(stats.mailbox_high_watermark, 4U);
+  ASSERT_EQ(stats.mailbox_dropped, 0U);
+
+  sys.Signal(bh);
+  WaitMailboxDepth(&sys, bh, 0);
+  int total = 0;
+  ASSERT_TRUE(sys.CallMethod(bh, &BoundedServiceTest::Get, &total));
+  ASSERT_EQ(total, 4);
+}
+
+TEST_F(SystemTest, DropOldestMailboxTestCase) {
+  ServiceOptions options;
+  options.mailbox_capacity = 2;
+  options.overflow_policy = MailboxOverflowPolicy::kDropOldest;
+  auto bh = LaunchHeldService(&sys, options);
+  ASSERT_TRUE(bh);
+
+  std::atomic<int> dropped{0};
+  auto done = [&dropped](const Status& s) {
+    if (s.IsAgain())
+      ++dropped;
+  };
+  for (int i = 1; i <= 4; ++i) {
+    ASSERT_TRUE(sys.AsyncCallMethod(bh, done, &BoundedServiceTest::Add, i));
+  }
+  ASSERT_EQ(dropped.load(), 2);
+
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(bh, &stats));
+  ASSERT_EQ(stats.mailbox_depth, 2U);
+  ASSERT_EQ(stats.mailbox_dropped, 2U);
+
+  // only the two newest messages are handled
+  sys.Signal(bh);
+  WaitMailboxDepth(&sys, bh, 0);
+  int total = 0;
+  ASSERT_TRUE(sys.CallMethod(bh, &BoundedServiceTest::Get, &total));
+  ASSERT_EQ(total, 3 + 4);
+}
+
+struct SyncCallerTest : public UserThreadService {
+  SyncCallerTest(System* sys, const std::string& name, BasicHandle<BoundedServiceTest> dest,
+                 Status* status, int* res, Test_Task* tt)
+      : UserThreadService(sys, name), dest_(dest), status_(status), res_(res), test_task(tt) {}
+
+  void Main() override {
+    *status_ = system()->CallMethod(dest_, &BoundedServiceTest::Get, res_);
+    test_task->Done();
+  }
+
+  BasicHandle<BoundedServiceTest> dest_;
+  Status* status_;
+  int* res_;
+  Test_Task* test_task = nullptr;
+};
+
+static void WaitMailboxDropped(System* sys, const System::Handle& h, uint64_t dropped) {
+  ServiceStats stats;
+  do {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    sys->GetServiceStats(h, &stats);
+  } while (stats.mailbox_dropped != dropped);
+}
+
+TEST_F(SystemTest, DropOldestSyncCallTestCase) {
+  ServiceOptions options;
+  options.mailbox_capacity = 1;
+  options.overflow_policy = MailboxOverflowPolicy::kDropOldest;
+  auto bh = LaunchHeldService(&sys, options);
+  ASSERT_TRUE(bh);
+
+  // a service calling: its call is dropped by the next message
+  Status status;
+  int res = -1;
+  ASSERT_TRUE(sys.LaunchService<SyncCallerTest>("SyncCallerTest", bh, &status, &res,
+                                                &test_task));
+  WaitMailboxDepth(&sys, bh, 1);
+  ASSERT_TRUE(sys.AsyncCallMethod(bh, &BoundedServiceTest::Add, 1));
+  test_task.Wait();
+  ASSERT_TRUE(status.IsAgain());
+  ASSERT_EQ(res, -1);
+
+  // a thread calling: its call drops the Add, then is dropped in turn
+  Status thread_status;
+  std::thread caller([&]() {
+    thread_status = sys.CallMethod(bh, &BoundedServiceTest::Get, &res);
+  });
+  WaitMailboxDropped(&sys, bh, 2);
+  ASSERT_TRUE(sys.AsyncCallMethod(bh, &BoundedServiceTest::Add, 2));
+  caller.join();
+  ASSERT_TRUE(thread_status.IsAgain());
+  ASSERT_EQ(res, -1);
+
+  sys.Signal(bh);
+  WaitMailboxDepth(&sys, bh, 0);
+  int total = 0;
+  ASSERT_TRUE(sys.CallMethod(bh, &BoundedServiceTest::Get, &total));
+  ASSERT_EQ(total, 2);
+}
+
+struct BlockedSenderTest : public UserThreadService {
+  BlockedSenderTest(System* sys, const std::string& name,
+                    BasicHandle<BoundedServiceTest> dest, int messages, Test_Task* tt)
+      : UserThreadService(sys, name), dest_(dest), messages_(messages), test_task(tt) {}
+
+  void Main() override {
+    for (int i = 0; i < messages_; ++i) {
+      ASSERT_TRUE(system()->AsyncCallMethod(dest_, &BoundedServiceTest::Add, 1));
+    }
+    test_task->Done();
+  }
+
+  BasicHandle<BoundedServiceTest> dest_;
+  int messages_;
+  Test_Task* test_task = nullptr;
+};
+
+TEST_F(SystemTest, BlockingMailboxTestCase) {
+  ServiceOptions options;
+  options.mailbox_capacity = 2;
+  options.overflow_policy = MailboxOverflowPolicy::kBlock;
+  auto bh = LaunchHeldService(&sys, options);
+  ASSERT_TRUE(bh);
+
+  const int messages = 100;
+  ASSERT_TRUE(sys.LaunchService<BlockedSenderTest>("BlockedSenderTest", bh, messages,
+                                                   &test_task));
+
+  // the sender service waits, other threads still fail fast
+  WaitMailboxDepth(&sys, bh, 2);
+  ASSERT_TRUE(sys.AsyncCallMethod(bh, &BoundedServiceTest::Add, 1).IsAgain());
+
+  sys.Signal(bh);
+  test_task.Wait();
+  WaitMailboxDepth(&sys, bh, 0);
+
+  int total = 0;
+  ASSERT_TRUE(sys.CallMethod(bh, &BoundedServiceTest::Get, &total));
+  ASSERT_EQ(total, messages);
+
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(bh, &stats));
+  ASSERT_EQ(stats.mailbox_high_watermark, 2U);
+}
+
+struct BusyServiceTest : public UserThreadService {
+  BusyServiceTest(System* sys, const std::string& name, std::atomic<bool>* stop,
+                  std::atomic<int>* finished)
+      : UserThreadService(sys, name), stop_(stop), finished_(finished) {}
+
+  void Main() override {
+    while (!stop_->load(std::memory_order_relaxed)) {
+      auto const until = std::chrono::steady_clock::now() + std::chrono::microseconds(100);
+      while (std::chrono::steady_clock::now() < until) {
+      }
+      Yield();
+    }
+    ++*finished_;
+  }
+
+  std::atomic<bool>* stop_;
+  std::atomic<int>* finished_;
+};
+
+struct ProbeServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Ping(std::chrono::steady_clock::time_point sent) {
+    latencies.push_back(std::chrono::steady_clock::now() - sent);
+  }
+
+  void Get(std::vector<std::chrono::steady_clock::duration>* res) {
+    *res = latencies;
+  }
+
+  std::vector<std::chrono::steady_clock::duration> latencies;
+};
+
+TEST_F(SystemTest, PriorityWakeupLatencyTestCase) {
+  // 200 busy services make a full pass over the ready queues take 20ms
+  std::atomic<bool> stop{false};
+  std::atomic<int> finished{0};
+  const int busy = 200;
+  for (int i = 0; i < busy; ++i) {
+    ASSERT_TRUE(sys.LaunchService<BusyServiceTest>("BusyServiceTest", &stop, &finished));
+  }
+
+  ServiceOptions options;
+  options.priority = ServicePriority::kHigh;
+  auto ph = sys.LaunchServiceWithOptions<ProbeServiceTest>(options, "ProbeServiceTest");
+  ASSERT_TRUE(ph);
+
+  const int probes = 200;
+  for (int i = 0; i < probes; ++i) {
+    ASSERT_TRUE(sys.AsyncCallMethod(ph, &ProbeServiceTest::Ping,
+                                    std::chrono::steady_clock::now()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::vector<std::chrono::steady_clock::duration> latencies;
+  auto const status = sys.CallMethod(ph, &ProbeServiceTest::Get, &latencies);
+  stop = true;
+  while (finished.load() != busy) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // a normal priority probe waits for about a second here
+  ASSERT_TRUE(status);
+  ASSERT_EQ(latencies.size(), static_cast<size_t>(probes));
+  std::sort(latencies.begin(), latencies.end());
+  auto const p99 = latencies[latencies.size() * 99 / 100];
+  ASSERT_LT(p99, std::chrono::milliseconds(50));
+}
+
+struct CpuServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void GetCpu(int* cpu) {
+    *cpu = sched_getcpu();
+  }
+};
+
+TEST(SystemStartTest, StartOptionsTestCase) {
+  StartOptions options;
+  options.worker_num = 2;
+  options.worker_cpus = {{0}};
+  options.io_cpus = {0};
+  options.timer_cpus = {0};
+  options.numa_aware = true;
+
+  System sys;
+  ASSERT_TRUE(sys.Start(options));
+  ASSERT_TRUE(sys.numa_aware());
+
+  auto ch = sys.LaunchService<CpuServiceTest>("CpuServiceTest");
+  ASSERT_TRUE(ch);
+  for (int i = 0; i < 10; ++i) {
+    int cpu = -1;
+    ASSERT_TRUE(sys.CallMethod(ch, &CpuServiceTest::GetCpu, &cpu));
+    ASSERT_EQ(cpu, 0);
+  }
+  sys.Stop();
+}
+
+TEST(SystemStartTest, ShardedTestCase) {
+  StartOptions options;
+  options.worker_num = 2;
+  options.sharded = true;
+  options.max_workers = 4;  // ignored
+
+  System sys;
+  ASSERT_TRUE(sys.Start(options));
+  ASSERT_TRUE(sys.sharded());
+  ASSERT_EQ(sys.WorkerCount(), 2);
+
+  ServiceOptions counter_options;
+  counter_options.shard = 1;
+  auto ch = sys.LaunchServiceWithOptions<CounterServiceTest>(counter_options,
+                                                             "CounterServiceTest");
+  ASSERT_TRUE(ch);
+
+  // the senders are spread over both shards
+  const int senders = 8;
+  const int messages = 2000;
+  std::atomic<int> finished{0};
+  for (int i = 0; i < senders; ++i) {
+    ASSERT_TRUE(sys.LaunchService<SenderServiceTest>("SenderServiceTest", ch, messages,
+                                                     &finished));
+  }
+
+  while (finished.load() != senders) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  int total = 0;
+  ASSERT_TRUE(sys.CallMethod(ch, &CounterServiceTest::Get, &total));
+  ASSERT_EQ(total, senders * messages);
+
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(ch, &stats));
+  ASSERT_EQ(stats.migrations, 0U);
+  sys.Stop();
+}
+
+// keeps a pattern of its own in a local array across the switches
+struct StackPatternServiceTest : public UserThreadService {
+  StackPatternServiceTest(System* sys, const std::string& name, int id,
+                          std::atomic<int>* errors, std::atomic<int>* finished)
+      : UserThreadService(sys, name), id_(id), errors_(errors), finished_(finished) {}
+
+  void Main() override {
+    char pattern[3000];
+    memset(pattern, id_, sizeof pattern);
+    for (int i = 0; i < 200; ++i) {
+      Yield();
+      if (std::count(pattern, pattern + sizeof pattern, static_cast<char>(id_)) !=
+          static_cast<std::ptrdiff_t>(sizeof pattern))
+        ++*errors_;
+    }
+    ++*finished_;
+  }
+
+  int id_;
+  std::atomic<int>* errors_;
+  std::atomic<int>* finished_;
+};
+
+TEST(SystemStartTest, SharedStackTestCase) {
+  ServiceOptions shared;
+  shared.shared_stack = true;
+  {
+    System sys;
+    ASSERT_TRUE(sys.Start(1));
+    ASSERT_FALSE(sys.LaunchServiceWithOptions<MethodCallServiceTest>(shared, "Shared"));
+    sys.Stop();
+  }
+
+  StartOptions options;
+  options.worker_num = 2;
+  options.sharded = true;
+  System sys;
+  ASSERT_TRUE(sys.Start(options));
+
+  const int services = 6;
+  std::atomic<int> errors{0};
+  std::atomic<int> finished{0};
+  for (int i = 0; i < services; ++i) {
+    shared.shard = i % 2;
+    ASSERT_TRUE(sys.LaunchServiceWithOptions<StackPatternServiceTest>(
+        shared, "StackPatternServiceTest", i + 1, &errors, &finished));
+  }
+
+  shared.shard = 0;
+  auto sh = sys.LaunchServiceWithOptions<MethodCallServiceTest>(shared, "Shared");
+  ASSERT_TRUE(sh);
+  for (int i = 0; i < 100; ++i) {
+    int res = -1;
+    ASSERT_TRUE(sys.CallMethod(sh, &MethodCallServiceTest::foo1, i, &res));
+    ASSERT_EQ(res, i);
+  }
+
+  while (finished.load() != services) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(errors.load(), 0);
+  sys.Stop();
+}
+
+// keeps a rounding mode of its own across the switches
+struct RoundingServiceTest : public UserThreadService {
+  RoundingServiceTest(System* sys, const std::string& name, int mode,
+                      std::atomic<int>* errors, std::atomic<int>* finished)
+      : UserThreadService(sys, name), mode_(mode), errors_(errors), finished_(finished) {}
+
+  void Main() override {
+    fesetround(mode_);
+    for (int i = 0; i < 200; ++i) {
+      Yield();
+      if (fegetround() != mode_)
+        ++*errors_;
+    }
+    fesetround(FE_TONEAREST);
+    ++*finished_;
+  }
+
+  int mode_;
+  std::atomic<int>* errors_;
+  std::atomic<int>* finished_;
+};
+
+struct RoundingProbe {
+  std::atomic<bool> mode_set{false};
+  std::atomic<int> seen{-1};
+};
+
+// sets a rounding mode of its own and yields until the observer has looked
+// at the mode it resumed with
+struct RoundingLeakerTest : public UserThreadService {
+  RoundingLeakerTest(System* sys, const std::string& name, RoundingProbe* probe)
+      : UserThreadService(sys, name), probe_(probe) {}
+
+  void Main() override {
+    fesetround(FE_UPWARD);
+    probe_->mode_set.store(true);
+    while (probe_->seen.load() == -1) {
+      Yield();
+    }
+    fesetround(FE_TONEAREST);
+  }
+
+  RoundingProbe* probe_;
+};
+
+struct RoundingObserverTest : public UserThreadService {
+  RoundingObserverTest(System* sys, const std::string& name, RoundingProbe* probe)
+      : UserThreadService(sys, name), probe_(probe) {}
+
+  void Main() override {
+    while (!probe_->mode_set.load()) {
+      Yield();
+    }
+    Yield();
+    probe_->seen.store(fegetround());
+  }
+
+  RoundingProbe* probe_;
+};
+
+// the rounding mode a service resumes with after another one set its own on
+// the same worker
+static int ResumedRoundingMode(SwitchPolicy policy) {
+  System sys;
+  sys.SetSwitchPolicy(policy);
+  sys.Start(1);
+  RoundingProbe probe;
+  sys.LaunchService<RoundingObserverTest>("RoundingObserverTest", &probe);
+  sys.LaunchService<RoundingLeakerTest>("RoundingLeakerTest", &probe);
+  while (probe.seen.load() == -1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  sys.Stop();
+  return probe.seen.load();
+}
+
+TEST(SystemStartTest, SwitchPolicyTestCase) {
+  // every service keeps its own rounding mode
+  System sys;
+  ASSERT_TRUE(sys.Start(1));
+  std::atomic<int> errors{0};
+  std::atomic<int> finished{0};
+  for (int mode : {FE_UPWARD, FE_DOWNWARD, FE_TOWARDZERO, FE_TONEAREST}) {
+    ASSERT_TRUE(sys.LaunchService<RoundingServiceTest>("RoundingServiceTest", mode, &errors,
+                                                       &finished));
+  }
+  while (finished.load() != 4) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(errors.load(), 0);
+  sys.Stop();
+
+  // the FPU control state is saved with the context only when preserved,
+  // otherwise the services share the one of the worker
+  ASSERT_EQ(ResumedRoundingMode(SwitchPolicy::kPreserveFpu), FE_TONEAREST);
+  ASSERT_EQ(ResumedRoundingMode(SwitchPolicy::kNoFpu), FE_UPWARD);
+}
+
+struct BallServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Ball(BasicHandle<BallServiceTest> peer, int left, std::atomic<bool>* done) {
+    if (left == 0) {
+      *done = true;
+      return;
+    }
+    ASSERT_TRUE(system()->AsyncCallMethod(peer, &BallServiceTest::Ball,
+                                          BasicHandle<BallServiceTest>(handle()),
+                                          left - 1, done));
+  }
+};
+
+struct RunLog {
+  void Add(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(name);
+  }
+
+  std::vector<std::string> Order() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return order;
+  }
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+};
+
+struct OrderServiceTest : public MethodCallService {
+  using MethodCallService::MethodCallService;
+
+  void Mark(std::string name, RunLog* log) {
+    if (log)
+      log->Add(name);
+  }
+
+  void Wake(BasicHandle<OrderServiceTest> peer, RunLog* log) {
+    ASSERT_TRUE(system()->AsyncCallMethod(peer, &OrderServiceTest::Mark,
+                                          std::string("woken"), log));
+    log->Add("waker");
+  }
+
+  // keeps the worker busy until released, so the services woken meanwhile
+  // are all queued when it returns
+  void Hold(std::atomic<bool>* held, std::atomic<bool>* release) {
+    *held = true;
+    while (!release->load()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+};
+
+// the order one worker runs a waker, the service it wakes and three busy
+// services queued behind the waker
+static std::vector<std::string> WakeupOrder(SchedulingPolicy policy) {
+  System sys;
+  sys.SetSchedulingPolicy(policy);
+  EXPECT_TRUE(sys.Start(1));
+
+  std::vector<BasicHandle<OrderServiceTest>> srvs;
+  for (int i = 0; i < 6; ++i) {
+    srvs.push_back(sys.LaunchService<OrderServiceTest>("OrderServiceTest"));
+    // run once, then they are all queued on the worker when woken
+    EXPECT_TRUE(sys.CallMethod(srvs.back(), &OrderServiceTest::Mark, std::string(),
+                               static_cast<RunLog*>(nullptr)));
+  }
+  auto& gate = srvs[0];
+  auto& waker = srvs[1];
+  auto& woken = srvs[2];
+
+  RunLog log;
+  std::atomic<bool> held{false};
+  std::atomic<bool> release{false};
+  EXPECT_TRUE(sys.AsyncCallMethod(gate, &OrderServiceTest::Hold, &held, &release));
+  while (!held.load()) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  EXPECT_TRUE(sys.AsyncCallMethod(waker, &OrderServiceTest::Wake, woken, &log));
+  for (size_t i = 3; i < srvs.size(); ++i) {
+    EXPECT_TRUE(sys.AsyncCallMethod(srvs[i], &OrderServiceTest::Mark, std::string("busy"),
+                                    &log));
+  }
+  release = true;
+
+  while (log.Order().size() != 5) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  sys.Stop();
+  return log.Order();
+}
+
+TEST(SystemStartTest, LifoSlotTestCase) {
+  // the woken service runs as soon as the waker blocks
+  std::vector<std::string> const lifo{"waker", "woken", "busy", "busy", "busy"};
+  ASSERT_EQ(WakeupOrder(SchedulingPolicy::kLifoSlot), lifo);
+
+  // in FIFO order it waits behind the busy services
+  std::vector<std::string> const fifo{"waker", "busy", "busy", "busy", "woken"};
+  ASSERT_EQ(WakeupOrder(SchedulingPolicy::kFifo), fifo);
+}
+
+TEST(SystemStartTest, StacklessTestCase) {
+  ServiceOptions stackless;
+  stackless.stackless = true;
+  System sys;
+  ASSERT_TRUE(sys.Start(2));
+  ASSERT_FALSE(sys.LaunchServiceWithOptions<StackPatternServiceTest>(
+      stackless, "StackPatternServiceTest", 1, nullptr, nullptr));
+
+  auto sh = sys.LaunchServiceWithOptions<MethodCallServiceTest>(stackless, "Stackless");
+  ASSERT_TRUE(sh);
+  for (int i = 0; i < 100; ++i) {
+    int res = -1;
+    ASSERT_TRUE(sys.CallMethod(sh, &MethodCallServiceTest::foo1, i, &res));
+    ASSERT_EQ(res, i);
+  }
+
+  ServiceStats stats;
+  ASSERT_TRUE(sys.GetServiceStats(sh, &stats));
+  ASSERT_EQ(stats.messages_handled, 100U);
+  ASSERT_GT(stats.switches, 0U);
+  ASSERT_LE(stats.switches, 100U);
+
+  // a stackless service passes the ball with one that has a stack, which
+  // switches to the idle service to run it
+  auto ping = sys.LaunchServiceWithOptions<BallServiceTest>(stackless, "BallServiceTest");
+  auto pong = sys.LaunchService<BallServiceTest>("BallServiceTest");
+  ASSERT_TRUE(ping && pong);
+  std::atomic<bool> done{false};
+  ASSERT_TRUE(sys.AsyncCallMethod(ping, &BallServiceTest::Ball, pong, 1000, &done));
+  while (!done.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  ASSERT_TRUE(sys.GetServiceStats(ping, &stats));
+  ASSERT_EQ(stats.messages_handled, 501U);
+  sys.Stop();
+}
+
+TEST(SystemStartTest, TracingTestCase) {
+  System sys;
+  std::ostringstream os;
+  ASSERT_FALSE(sys.WriteChromeTrace(os));
+
+  sys.SetTracing(1024);
+  ASSERT_TRUE(sys.Start(2));
+  auto sh = sys.LaunchService<MethodCallServiceTest>("TracedService");
+  ASSERT_TRUE(sh);
+  for (int i = 0; i < 10; ++i) {
+    int res = 0;
+    ASSERT_TRUE(sys.CallMethod(sh, &MethodCallServiceTest::foo1, i, &res));
+  }
+
+  // the service blocks for the next message only after the last reply has
+  // woken this thread, so its wait may not be recorded yet
+  std::string json;
+  auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  do {
+    std::ostringstream trace;
+    ASSERT_TRUE(sys.WriteChromeTrace(trace));
+    json = trace.str();
+    if (json.find("\"name\":\"wait\"") != std::string::npos)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  } while (std::chrono::steady_clock::now() < deadline);
+  sys.Stop();
+
+  ASSERT_NE(json.find("\"name\":\"TracedService\",\"ph\":\"X\""), std::string::npos);
+  ASSERT_NE(json.find("\"events\":\"[Message]\""), std::string::npos);
+  ASSERT_NE(json.find("\"name\":\"wait\""), std::string::npos);
+}
+
+// runs busy services until the pool has grown to max_workers
+static int GrowWorkers(System* sys, int max_workers) {
+  std::atomic<bool> stop{false};
+  std::atomic<int> finished{0};
+  int launched = 0;
+  for (; launched < 20; ++launched) {
+    if (!sys->LaunchService<BusyServiceTest>("BusyServiceTest", &stop, &finished))
+      break;
+  }
+
+  auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (sys->WorkerCount() < max_workers && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  int const workers = sys->WorkerCount();
+  stop = true;
+  while (finished.load() != launched) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return workers;
+}
+
+static int ShrinkWorkers(System* sys, int min_workers) {
+  auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (sys->WorkerCount() > min_workers && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return sys->WorkerCount();
+}
+
+TEST(SystemStartTest, ElasticWorkersTestCase) {
+  StartOptions options;
+  options.worker_num = 1;
+  options.max_workers = 3;
+  options.worker_idle_timeout_ms = 50;
+
+  System sys;
+  ASSERT_TRUE(sys.Start(options));
+  ASSERT_EQ(sys.WorkerCount(), 1);
+
+  ASSERT_EQ(GrowWorkers(&sys, 3), 3);
+  ASSERT_EQ(ShrinkWorkers(&sys, 1), 1);
+
+  // the slots of the retired workers are reused
+  ASSERT_EQ(GrowWorkers(&sys, 3), 3);
+  ASSERT_EQ(ShrinkWorkers(&sys, 1), 1);
+
+  WorkerPoolStats stats;
+  sys.GetWorkerPoolStats(&stats);
+  ASSERT_EQ(stats.workers, 1);
+  ASSERT_EQ(stats.min_workers, 1);
+  ASSERT_EQ(stats.max_workers, 3);
+  ASSERT_EQ(stats.workers_added, 4U);
+  ASSERT_EQ(stats.workers_retired, 4U);
+
+  auto ch = sys.LaunchService<CpuServiceTest>("CpuServiceTest");
+  ASSERT_TRUE(ch);
+  int cpu = -1;
+  ASSERT_TRUE(sys.CallMethod(ch, &CpuServiceTest::GetCpu, &cpu));
+  sys.Stop();
+}
+
 struct WakeupSleepServiceTest : public UserThreadService {
   WakeupSleepServiceTest(System* sys, const std::string& name, Test_Task* tt)
       : UserThreadService(sys, name), test_task(tt) {}
@@ -17,6 +17,7 @@ Status TcpConnection::Read(void *pbuffer, size_t const n) {
     auto r = net::tcp::Recv(sockfd_, buf + (n - read_left), read_left);
     if (r) {
       read_left -= r.get();
+      srv_->ConsumeBudget();
     } else if (r.status().IsAgain()) {
       auto s = srv_->WaitInput(sockfd_);
       if (!s)
@@ -42,6 +43,7 @@ Result<size_t> TcpConnection::ReadSome(void *pbuffer,
   while (true) {
     auto r = net::tcp::Recv(sockfd_, pbuffer, buffer_size);  // nonblocking
     if (r) {
+      srv_->ConsumeBudget();
       return r;
     } else if (r.status().IsAgain()) {
       auto s = srv_->WaitInput(sockfd_);
@@ -66,6 +68,7 @@ Status TcpConnection::Write(const void *pbuffer, size_t const n) {
                             MSG_NOSIGNAL);
     if (r) {
       write_left -= r.get();
+      srv_->ConsumeBudget();
     } else if (r.status().IsAgain()) {
       auto s = srv_->WaitOutput(sockfd_);
       if (!s)
@@ -0,0 +1,154 @@
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+#include "ServiceEvent.h"
+
+namespace mcast {
+
+TraceBuffer::TraceBuffer(size_t capacity) {
+  size_t n = 1;
+  while (n < capacity) {
+    n <<= 1;
+  }
+  events_.reset(new TraceEvent[n]);
+  mask_ = n - 1;
+}
+
+void TraceBuffer::Snapshot(std::vector<TraceEvent>* out) const {
+  uint64_t const capacity = mask_ + 1;
+  uint64_t const end = written_.load(std::memory_order_acquire);
+  uint64_t const begin = end > capacity ? end - capacity : 0;
+  size_t const old_size = out->size();
+  for (uint64_t i = begin; i < end; ++i) {
+    out->push_back(events_[i & mask_]);
+  }
+
+  // the owner may have overwritten the oldest events meanwhile, and may be
+  // writing the next one
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t const written = written_.load(std::memory_order_relaxed);
+  if (written + 1 > begin + capacity) {
+    uint64_t const drop = std::min(written + 1 - capacity - begin, end - begin);
+    out->erase(out->begin() + static_cast<std::ptrdiff_t>(old_size),
+               out->begin() + static_cast<std::ptrdiff_t>(old_size + drop));
+  }
+}
+
+void Tracer::Start(int workers, size_t events_per_thread) {
+  buffers_.clear();
+  for (int i = 0; i <= workers; ++i) {
+    buffers_.emplace_back(new TraceBuffer(events_per_thread));
+  }
+  start_cycles_ = internal::CpuCycles();
+  start_time_ = std::chrono::steady_clock::now();
+}
+
+static void WriteJsonString(std::ostream& os, const std::string& s) {
+  os << '"';
+  for (char const c : s) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof buf, "\\u%04x", static_cast<unsigned>(c));
+      os << buf;
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+void Tracer::WriteChromeTrace(std::ostream& os, const NameFunction& name,
+                              int64_t idle_index) const {
+  // the TSC rate, measured over the whole trace
+  double const us = std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - start_time_)
+                        .count();
+  uint64_t const now = internal::CpuCycles();
+  uint64_t const cycles = now - start_cycles_;
+  double const cycles_per_us = us > 0 && cycles > 0 ? static_cast<double>(cycles) / us : 1;
+  auto const ts = [this, cycles_per_us](uint64_t c) {
+    return c > start_cycles_ ? static_cast<double>(c - start_cycles_) / cycles_per_us : 0;
+  };
+
+  std::unordered_map<int64_t, std::string> names;
+  auto const service_name = [&names, &name](int64_t index) -> const std::string& {
+    auto it = names.find(index);
+    if (it == names.end())
+      it = names.emplace(index, index < 0 ? std::string() : name(index)).first;
+    return it->second;
+  };
+
+  auto const flags = os.flags();
+  os.setf(std::ios::fixed);
+  auto const precision = os.precision(3);
+
+  os << "{\"traceEvents\":[";
+  bool first = true;
+  auto const begin_event = [&os, &first](const std::string& event_name, const char* ph,
+                                         size_t tid, double time) {
+    os << (first ? "\n" : ",\n") << "{\"name\":";
+    WriteJsonString(os, event_name);
+    os << ",\"ph\":\"" << ph << "\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << time;
+    first = false;
+  };
+
+  std::vector<TraceEvent> events;
+  for (size_t tid = 0; tid < buffers_.size(); ++tid) {
+    begin_event("thread_name", "M", tid, 0);
+    os << ",\"args\":{\"name\":";
+    WriteJsonString(os, tid + 1 < buffers_.size() ? "worker " + std::to_string(tid)
+                                                  : std::string("other threads"));
+    os << "}}";
+
+    events.clear();
+    buffers_[tid]->Snapshot(&events);
+    // a service runs from its switch to the next one on the same worker, the
+    // one still running ends now
+    const TraceEvent* running = nullptr;
+    auto const end_slice = [&](uint64_t end) {
+      if (running && running->service != idle_index) {
+        begin_event(service_name(running->service), "X", tid, ts(running->cycles));
+        os << ",\"dur\":" << ts(end) - ts(running->cycles)
+           << ",\"args\":{\"handle\":" << running->service << "}}";
+      }
+    };
+    for (auto const& e : events) {
+      switch (e.type) {
+        case TraceEventType::kSwitch:
+          end_slice(e.cycles);
+          running = &e;
+          break;
+        case TraceEventType::kWakeup:
+          begin_event("wakeup", "i", tid, ts(e.cycles));
+          os << ",\"s\":\"t\",\"args\":{\"service\":";
+          WriteJsonString(os, service_name(e.service));
+          os << ",\"by\":";
+          WriteJsonString(os, service_name(e.other));
+          os << ",\"events\":";
+          WriteJsonString(os, ServiceEventToText(e.events));
+          os << "}}";
+          break;
+        case TraceEventType::kWait:
+          begin_event("wait", "i", tid, ts(e.cycles));
+          os << ",\"s\":\"t\",\"args\":{\"service\":";
+          WriteJsonString(os, service_name(e.service));
+          os << ",\"events\":";
+          WriteJsonString(os, ServiceEventToText(e.events));
+          os << "}}";
+          break;
+      }
+    }
+    end_slice(now);
+  }
+  os << "\n]}\n";
+
+  os.precision(precision);
+  os.flags(flags);
+}
+
+}  // namespace mcast
@@ -0,0 +1,100 @@
+#ifndef CAST_TRACER_H_
+#define CAST_TRACER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "util/Noncopyable.h"
+#include "util/Timer.h"
+
+namespace mcast {
+
+enum class TraceEventType : uint32_t {
+  kSwitch,  // service starts running, other is the one switched out
+  kWakeup,  // service is woken by other(-1 for non-service threads) with events
+  kWait,    // service blocks waiting for events
+};
+
+struct TraceEvent {
+  uint64_t cycles = 0;
+  int64_t service = -1;  // handle indexes
+  int64_t other = -1;
+  uint32_t events = 0;
+  TraceEventType type = TraceEventType::kSwitch;
+};
+
+// TraceBuffer is a ring holding the latest events of one thread. The owner
+// records without locks and overwrites the oldest events, Snapshot may be
+// called by any thread and drops the events overwritten while it copies.
+class TraceBuffer : public Noncopyable {
+ public:
+  // the capacity is rounded up to a power of 2
+  explicit TraceBuffer(size_t capacity);
+
+  void Record(TraceEventType type, int64_t service, int64_t other, uint32_t events) {
+    uint64_t const n = written_.load(std::memory_order_relaxed);
+    TraceEvent& e = events_[n & mask_];
+    e.cycles = internal::CpuCycles();
+    e.service = service;
+    e.other = other;
+    e.events = events;
+    e.type = type;
+    written_.store(n + 1, std::memory_order_release);
+  }
+
+  // appends the events in the buffer to out, oldest first
+  void Snapshot(std::vector<TraceEvent>* out) const;
+
+  size_t Capacity() const {
+    return mask_ + 1;
+  }
+
+ private:
+  std::unique_ptr<TraceEvent[]> events_;
+  uint64_t mask_ = 0;
+  std::atomic<uint64_t> written_{0};
+};
+
+// Tracer keeps a TraceBuffer per worker, the other threads(io, timer, user
+// threads) share one more buffer under a lock. WriteChromeTrace exports the
+// events in the Chrome trace event format, which Perfetto and
+// chrome://tracing open: a slice per service run on each worker, and instant
+// events for the wakeups and the blocking waits.
+class Tracer : public Noncopyable {
+ public:
+  typedef std::function<std::string(int64_t)> NameFunction;
+
+  void Start(int workers, size_t events_per_thread);
+
+  TraceBuffer* worker_buffer(int i) {
+    return buffers_[static_cast<size_t>(i)].get();
+  }
+
+  void RecordOther(TraceEventType type, int64_t service, int64_t other, uint32_t events) {
+    std::lock_guard<std::mutex> gl(other_mutex_);
+    buffers_.back()->Record(type, service, other, events);
+  }
+
+  // name gives the name of a service by its handle index, a service whose
+  // index is idle_index is left out
+  void WriteChromeTrace(std::ostream& os, const NameFunction& name, int64_t idle_index) const;
+
+ private:
+  std::vector<std::unique_ptr<TraceBuffer>> buffers_;  // the workers', then the others'
+  std::mutex other_mutex_;
+  uint64_t start_cycles_ = 0;
+  std::chrono::steady_clock::time_point start_time_;
+};
+
+}  // namespace mcast
+
+#endif  // CAST_TRACER_H_
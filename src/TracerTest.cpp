@@ -0,0 +1,53 @@
+#include "Tracer.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ServiceEvent.h"
+#include "util/Test.h"
+
+using namespace mcast;
+
+TEST(TracerTest, TraceBufferWrapTestCase) {
+  TraceBuffer buffer(3);
+  ASSERT_EQ(buffer.Capacity(), 4U);
+
+  for (int i = 0; i < 10; ++i) {
+    buffer.Record(TraceEventType::kWait, i, -1, ServiceEvent::kMessage);
+  }
+
+  // the oldest events are overwritten
+  std::vector<TraceEvent> events;
+  buffer.Snapshot(&events);
+  ASSERT_EQ(events.size(), 3U);  // the slot written next may be torn
+  for (size_t i = 0; i < events.size(); ++i) {
+    ASSERT_EQ(events[i].service, static_cast<int64_t>(7 + i));
+    ASSERT_EQ(events[i].type, TraceEventType::kWait);
+  }
+  ASSERT_LE(events[0].cycles, events[2].cycles);
+}
+
+TEST(TracerTest, ChromeTraceTestCase) {
+  Tracer tracer;
+  tracer.Start(1, 16);
+  auto* buffer = tracer.worker_buffer(0);
+  buffer->Record(TraceEventType::kSwitch, 5, 1, 0);
+  buffer->Record(TraceEventType::kWait, 5, -1, ServiceEvent::kMessage);
+  buffer->Record(TraceEventType::kSwitch, 1, 5, 0);
+  tracer.RecordOther(TraceEventType::kWakeup, 5, -1, ServiceEvent::kIO_Operation);
+
+  std::ostringstream os;
+  tracer.WriteChromeTrace(
+      os, [](int64_t index) { return "srv\"" + std::to_string(index); }, 1);
+  std::string const json = os.str();
+
+  ASSERT_EQ(json.find("{\"traceEvents\":["), 0U);
+  ASSERT_NE(json.find("\"name\":\"srv\\\"5\",\"ph\":\"X\",\"pid\":1,\"tid\":0"),
+            std::string::npos);
+  ASSERT_NE(json.find("\"name\":\"wait\""), std::string::npos);
+  ASSERT_NE(json.find("\"tid\":1"), std::string::npos);
+  ASSERT_NE(json.find("IO_Operation"), std::string::npos);
+  // the idle service has no slice
+  ASSERT_EQ(json.find("srv\\\"1"), std::string::npos);
+}
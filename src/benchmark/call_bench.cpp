@@ -0,0 +1,104 @@
+// Synchronous request/response: every Caller service calls its own Callee
+// with CallMethod in a loop, the benchmark reports the round trip time of one
+// call.
+
+#include <atomic>
+#include <cstdlib>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<int> finished{0};
+std::atomic<bool> go{false};
+
+class Callee : public MethodCallService {
+ public:
+  using MethodCallService::MethodCallService;
+
+  void Ping(int n, int* res) {
+    *res = n + 1;
+  }
+};
+
+class Caller : public UserThreadService {
+ public:
+  Caller(System* sys, const std::string& name, BasicHandle<Callee> callee, int calls)
+      : UserThreadService(sys, name), callee_(callee), calls_(calls) {}
+
+  void Main() override {
+    while (!go.load(std::memory_order_acquire)) {
+      Sleep(10);
+    }
+
+    int res = 0;
+    for (int i = 0; i < calls_; ++i) {
+      if (!system()->CallMethod(callee_, &Callee::Ping, i, &res) || res != i + 1) {
+        LOG_WARN << "call_bench: CallMethod failed";
+        break;
+      }
+    }
+    ++finished;
+  }
+
+ private:
+  BasicHandle<Callee> callee_;
+  int calls_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 4) {
+    LOG_WARN << "Usage: call_bench threads pairs calls";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const int pairs = std::atoi(argv[2]);
+  const int calls = std::atoi(argv[3]);
+  if (pairs <= 0 || calls <= 0) {
+    LOG_WARN << "call_bench: require pairs > 0 and calls > 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running CallMethod benchmark: threads " << threads << " pairs " << pairs
+           << " calls " << calls;
+
+  System sys;
+  sys.Start(threads);
+
+  for (int i = 0; i < pairs; ++i) {
+    auto callee = sys.LaunchService<Callee>("Callee");
+    if (!callee ||
+        !sys.LaunchService<Caller, System::kSmallStackSize>("Caller", callee, calls)) {
+      LOG_WARN << "LaunchService failed," << i;
+      return -1;
+    }
+  }
+
+  this_thread::SleepFor(std::chrono::milliseconds(100));
+  Timer timer;
+  timer.Start();
+  go.store(true, std::memory_order_release);
+  while (finished.load() != pairs) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const auto elapsed = timer.Elapsed();
+  sys.Stop();
+
+  const double total = static_cast<double>(pairs) * calls;
+  LOG_INFO << total << " calls in " << elapsed.ToSeconds() << " seconds";
+  LOG_INFO << std::fixed << static_cast<double>(elapsed.ToNonoseconds()) / total * pairs
+           << " ns per call round trip";
+}
@@ -0,0 +1,107 @@
+// Connection churn: a client opens a connection to a TcpServer, does one echo
+// round trip and closes it, in a loop, so every connection launches and
+// retires a TcpConnectionService. The benchmark reports the connections per
+// second with the stack pool turned off, every stack mmapped and munmapped,
+// and with the stack pool.
+
+#include <unistd.h>
+
+#include <cstdlib>
+
+#include "google/protobuf/message.h"
+
+#include "StackPool.h"
+#include "System.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+#include "util/Logging.h"
+#include "util/Timer.h"
+#include "util/socketops.h"
+
+using namespace mcast;
+
+namespace {
+
+// returns the connections per second, 0 on failure
+double Run(int threads, uint16_t port, int connections) {
+  System sys;
+  if (!sys.Start(threads))
+    return 0;
+
+  TcpServer server;
+  server.SetOnNewConnection([](TcpConnection* conn) {
+    return [conn]() mutable {
+      char c = 0;
+      if (conn->Read(&c, 1))
+        conn->Write(&c, 1);
+    };
+  });
+  if (!server.Start(&sys, port)) {
+    LOG_WARN << "churn_bench: TcpServer Start failed, port " << port;
+    sys.Stop();
+    return 0;
+  }
+
+  Timer timer;
+  timer.Start();
+  int done = 0;
+  for (; done < connections; ++done) {
+    auto r = net::tcp::Socket();
+    if (!r)
+      break;
+    int const fd = r.get();
+    char c = 'x';
+    bool const ok = net::tcp::Connect(fd, "127.0.0.1", port) &&
+                    net::tcp::Send(fd, &c, 1) && net::tcp::Recv(fd, &c, 1);
+    close(fd);
+    if (!ok) {
+      LOG_WARN << "churn_bench: connection " << done << " failed";
+      break;
+    }
+  }
+  const double secs = timer.Elapsed().ToSeconds();
+
+  server.Stop();
+  sys.Stop();
+  return done == connections ? connections / secs : 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 4) {
+    LOG_WARN << "Usage: churn_bench threads port connections";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const uint16_t port = static_cast<uint16_t>(std::atoi(argv[2]));
+  const int connections = std::atoi(argv[3]);
+  if (connections <= 0) {
+    LOG_WARN << "churn_bench: require connections > 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running connection churn benchmark: threads " << threads << " port " << port
+           << " connections " << connections;
+
+  auto& pool = StackPool::Instance();
+  StackPool::Stats stats;
+
+  pool.SetLimits(0, 0);
+  const double unpooled = Run(threads, port, connections);
+  pool.GetStats(&stats);
+  LOG_INFO << "stacks mapped " << stats.mapped << " reused " << stats.reused;
+
+  pool.SetLimits(StackPool::kDefaultThreadCached, StackPool::kDefaultGlobalCached);
+  const double pooled = Run(threads, static_cast<uint16_t>(port + 1), connections);
+  StackPool::Stats pooled_stats;
+  pool.GetStats(&pooled_stats);
+  LOG_INFO << "stacks mapped " << pooled_stats.mapped - stats.mapped << " reused "
+           << pooled_stats.reused - stats.reused;
+
+  LOG_INFO << std::fixed << "no stack pool: " << unpooled << " connections/s";
+  LOG_INFO << std::fixed << "stack pool: " << pooled << " connections/s";
+}
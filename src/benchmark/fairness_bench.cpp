@@ -0,0 +1,170 @@
+// Fairness between connections: bulk clients stream data through an echo
+// server while interactive clients ping it with small messages, the
+// benchmark reports the round trip times of the interactive clients and the
+// bulk throughput. Run it with budget 0 (unlimited) and with a budget to see
+// how much a hot connection delays the others on its worker.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "google/protobuf/message.h"
+
+#include "System.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+#include "util/Logging.h"
+#include "util/socketops.h"
+
+using namespace mcast;
+
+namespace {
+
+const uint16_t kPort = 13097;
+const size_t kBulkChunkSize = 64 * 1024;
+const size_t kPingSize = 64;
+
+std::atomic<bool> stop{false};
+std::atomic<uint64_t> bulk_bytes{0};
+
+int ConnectToServer() {
+  auto r = net::tcp::Socket();
+  if (!r || !net::tcp::Connect(r.get(), "127.0.0.1", kPort)) {
+    LOG_WARN << "fairness_bench: connect failed";
+    std::exit(-1);
+  }
+  net::tcp::SetNoDelay(r.get());
+  return r.get();
+}
+
+bool RecvAll(int fd, char* buf, size_t n) {
+  size_t got = 0;
+  while (got < n) {
+    auto r = net::tcp::Recv(fd, buf + got, n - got);
+    if (!r)
+      return false;
+    got += r.get();
+  }
+  return true;
+}
+
+void BulkClient() {
+  int const fd = ConnectToServer();
+  std::thread writer([fd] {
+    std::vector<char> buf(kBulkChunkSize, 'b');
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (!net::tcp::Send(fd, buf.data(), buf.size(), MSG_NOSIGNAL))
+        break;
+    }
+    net::tcp::ShutdownWrite(fd);
+  });
+
+  std::vector<char> buf(kBulkChunkSize);
+  while (true) {
+    auto r = net::tcp::Recv(fd, buf.data(), buf.size());
+    if (!r)
+      break;
+    bulk_bytes.fetch_add(r.get(), std::memory_order_relaxed);
+  }
+  writer.join();
+  ::close(fd);
+}
+
+void InteractiveClient(std::vector<std::chrono::steady_clock::duration>* rtts) {
+  int const fd = ConnectToServer();
+  char buf[kPingSize] = {'i'};
+  while (!stop.load(std::memory_order_relaxed)) {
+    auto const start = std::chrono::steady_clock::now();
+    if (!net::tcp::Send(fd, buf, sizeof buf, MSG_NOSIGNAL) || !RecvAll(fd, buf, sizeof buf))
+      break;
+    rtts->push_back(std::chrono::steady_clock::now() - start);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ::close(fd);
+}
+
+double ToMicroseconds(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 5) {
+    LOG_WARN << "Usage: fairness_bench threads bulk interactive budget";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const int bulk = std::atoi(argv[2]);
+  const int interactive = std::atoi(argv[3]);
+  const int budget = std::atoi(argv[4]);
+  if (bulk < 0 || interactive <= 0 || budget < 0) {
+    LOG_WARN << "fairness_bench: require bulk >= 0, interactive > 0 and budget >= 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running fairness benchmark: threads " << threads << " bulk " << bulk
+           << " interactive " << interactive << " budget " << budget;
+
+  System sys;
+  sys.SetExecutionBudget(static_cast<uint32_t>(budget));
+  sys.Start(threads);
+
+  TcpServer server;
+  server.SetOnNewConnection([](TcpConnection* conn) {
+    conn->SetTcpNoDelay();
+    return [conn]() mutable {
+      std::vector<char> buf(kBulkChunkSize);
+      while (true) {
+        auto s = conn->ReadSome(buf.data(), buf.size());
+        if (!s || !conn->Write(buf.data(), s.get()))
+          return;
+      }
+    };
+  });
+  if (!server.Start(&sys, kPort)) {
+    LOG_WARN << "fairness_bench: TcpServer start failed";
+    return -1;
+  }
+
+  std::vector<std::thread> clients;
+  for (int i = 0; i < bulk; ++i) {
+    clients.emplace_back(BulkClient);
+  }
+  std::vector<std::vector<std::chrono::steady_clock::duration>> rtts(interactive);
+  for (int i = 0; i < interactive; ++i) {
+    clients.emplace_back(InteractiveClient, &rtts[i]);
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(3));
+  stop = true;
+  for (auto& t : clients) {
+    t.join();
+  }
+  server.Stop();
+  sys.Stop();
+
+  std::vector<std::chrono::steady_clock::duration> all;
+  for (auto& r : rtts) {
+    all.insert(all.end(), r.begin(), r.end());
+  }
+  if (all.empty()) {
+    LOG_WARN << "fairness_bench: no interactive round trip completed";
+    return -1;
+  }
+  std::sort(all.begin(), all.end());
+
+  LOG_INFO << "bulk " << bulk_bytes.load() / 3 / (1024 * 1024) << " MB/s";
+  LOG_INFO << std::fixed << "interactive round trips " << all.size() << ", p50 "
+           << ToMicroseconds(all[all.size() / 2]) << " us, p99 "
+           << ToMicroseconds(all[all.size() * 99 / 100]) << " us, max "
+           << ToMicroseconds(all.back()) << " us";
+}
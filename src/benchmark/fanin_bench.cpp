@@ -0,0 +1,97 @@
+// Many senders to one actor: every Sender service posts messages to a single
+// Sink with AsyncCallMethod, the benchmark reports the number of messages the
+// sink handled per second.
+
+#include <atomic>
+#include <cstdlib>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<uint64_t> handled{0};
+std::atomic<bool> go{false};
+
+class Sink : public MethodCallService {
+ public:
+  using MethodCallService::MethodCallService;
+
+  void Count() {
+    handled.store(handled.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+class Sender : public UserThreadService {
+ public:
+  Sender(System* sys, const std::string& name, BasicHandle<Sink> sink, int messages)
+      : UserThreadService(sys, name), sink_(sink), messages_(messages) {}
+
+  void Main() override {
+    while (!go.load(std::memory_order_acquire)) {
+      Sleep(10);
+    }
+
+    for (int i = 0; i < messages_; ++i) {
+      system()->AsyncCallMethod(sink_, &Sink::Count);
+    }
+  }
+
+ private:
+  BasicHandle<Sink> sink_;
+  int messages_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 4) {
+    LOG_WARN << "Usage: fanin_bench threads senders messages";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const int senders = std::atoi(argv[2]);
+  const int messages = std::atoi(argv[3]);
+  if (senders <= 0 || messages <= 0) {
+    LOG_WARN << "fanin_bench: require senders > 0 and messages > 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running fan-in benchmark: threads " << threads << " senders " << senders
+           << " messages " << messages;
+
+  System sys;
+  sys.Start(threads);
+
+  auto sink = sys.LaunchService<Sink>("Sink");
+  for (int i = 0; i < senders; ++i) {
+    if (!sys.LaunchService<Sender, System::kSmallStackSize>("Sender", sink, messages)) {
+      LOG_WARN << "LaunchService Sender failed," << i;
+      return -1;
+    }
+  }
+
+  this_thread::SleepFor(std::chrono::milliseconds(100));
+  const uint64_t total = static_cast<uint64_t>(senders) * static_cast<uint64_t>(messages);
+  Timer timer;
+  timer.Start();
+  go.store(true, std::memory_order_release);
+  while (handled.load(std::memory_order_relaxed) != total) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const double secs = timer.Elapsed().ToSeconds();
+  sys.Stop();
+
+  LOG_INFO << total << " messages in " << secs << " seconds";
+  LOG_INFO << std::fixed << static_cast<double>(total) / secs << " messages/s";
+}
@@ -0,0 +1,133 @@
+// The FPU control state in a context switch. First a raw jump_fcontext
+// round trip between the main context and one made on a stack of its own,
+// then a full Yield round trip between two services on one worker, each
+// with and without preserving the x87 control word and the MXCSR. The
+// benchmark reports the time of a round trip, two switches.
+
+#include <atomic>
+#include <cstdlib>
+#include <vector>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "libcontext.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+fcontext_t main_context;
+fcontext_t bouncer_context;
+bool bouncer_preserve_fpu = true;
+
+void BouncerMain(intptr_t) {
+  while (true) {
+    jump_fcontext(&bouncer_context, main_context, 0, bouncer_preserve_fpu);
+  }
+}
+
+// returns the nanoseconds per round trip
+double JumpTime(int round_trips, bool preserve_fpu) {
+  std::vector<char> stack(64 * 1024);
+  bouncer_preserve_fpu = preserve_fpu;
+  bouncer_context = make_fcontext(stack.data() + stack.size(), stack.size(), &BouncerMain);
+
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < round_trips; ++i) {
+    jump_fcontext(&main_context, bouncer_context, 0, preserve_fpu);
+  }
+  return static_cast<double>(timer.Elapsed().ToNonoseconds()) / round_trips;
+}
+
+std::atomic<int> started{0};
+std::atomic<int> finished{0};
+std::atomic<bool> go{false};
+
+class Yielder : public UserThreadService {
+ public:
+  Yielder(System* sys, const std::string& name, int yields)
+      : UserThreadService(sys, name), yields_(yields) {}
+
+  void Main() override {
+    ++started;
+    while (!go.load(std::memory_order_acquire)) {
+      Yield();
+    }
+
+    for (int i = 0; i < yields_; ++i) {
+      Yield();
+    }
+    ++finished;
+  }
+
+ private:
+  int yields_;
+};
+
+// returns the nanoseconds per round trip, 0 on failure
+double YieldTime(int round_trips, SwitchPolicy policy) {
+  started = 0;
+  finished = 0;
+  go = false;
+  System sys;
+  sys.SetSwitchPolicy(policy);
+  if (!sys.Start(1))
+    return 0;
+
+  const int services = 2;
+  for (int i = 0; i < services; ++i) {
+    if (!sys.LaunchService<Yielder, System::kSmallStackSize>("Yielder", round_trips)) {
+      LOG_WARN << "LaunchService Yielder failed," << i;
+      return 0;
+    }
+  }
+  while (started.load() != services) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+
+  Timer timer;
+  timer.Start();
+  go.store(true, std::memory_order_release);
+  while (finished.load() != services) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const auto elapsed = timer.Elapsed();
+  sys.Stop();
+
+  return static_cast<double>(elapsed.ToNonoseconds()) / round_trips;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 3) {
+    LOG_WARN << "Usage: fpu_switch_bench jumps yields";
+    return -1;
+  }
+
+  const int jumps = std::atoi(argv[1]);
+  const int yields = std::atoi(argv[2]);
+  if (jumps <= 0 || yields <= 0) {
+    LOG_WARN << "fpu_switch_bench: require jumps > 0 and yields > 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running fpu switch benchmark: jumps " << jumps << " yields " << yields;
+
+  const double jump_fpu = JumpTime(jumps, true);
+  const double jump_no_fpu = JumpTime(jumps, false);
+  const double yield_fpu = YieldTime(yields, SwitchPolicy::kPreserveFpu);
+  const double yield_no_fpu = YieldTime(yields, SwitchPolicy::kNoFpu);
+  LOG_INFO << std::fixed << "jump_fcontext round trip: " << jump_fpu << " ns preserving the fpu, "
+           << jump_no_fpu << " ns not";
+  LOG_INFO << std::fixed << "Yield round trip: " << yield_fpu << " ns preserving the fpu, "
+           << yield_no_fpu << " ns not";
+}
@@ -0,0 +1,97 @@
+// Measures the cpu time burnt by an idle System and the latency of waking up a
+// service from a non-worker thread, with idle workers parking and spinning.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <vector>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<uint64_t> woken_at{0};
+
+class SignalWaiter : public UserThreadService {
+ public:
+  using UserThreadService::UserThreadService;
+
+  void Main() override {
+    while (WaitSignal()) {
+      woken_at.store(Timestamp::Now().count(), std::memory_order_release);
+    }
+  }
+};
+
+double CpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void Run(int threads, int rounds, bool parking) {
+  System sys;
+  sys.SetIdleParking(parking);
+  sys.Start(threads);
+  auto h = sys.LaunchService<SignalWaiter>("SignalWaiter");
+
+  this_thread::SleepFor(std::chrono::milliseconds(100));
+  Timer wall;
+  wall.Start();
+  const double cpu_start = CpuSeconds();
+  this_thread::SleepFor(std::chrono::seconds(2));
+  const double idle_cpu = (CpuSeconds() - cpu_start) / wall.Elapsed().ToSeconds();
+
+  std::vector<uint64_t> latencies;
+  for (int i = 0; i < rounds; ++i) {
+    this_thread::SleepFor(std::chrono::milliseconds(5));  // let workers go idle
+    woken_at.store(0);
+    const uint64_t start = Timestamp::Now().count();
+    sys.Signal(h);
+    uint64_t end = 0;
+    while ((end = woken_at.load(std::memory_order_acquire)) == 0)
+      this_thread::Yield();
+    latencies.push_back(Timestamp(end - start).ToNonoseconds());
+  }
+  sys.Stop();
+
+  std::sort(latencies.begin(), latencies.end());
+  uint64_t total = 0;
+  for (auto l : latencies) {
+    total += l;
+  }
+
+  LOG_INFO << (parking ? "parking " : "spinning") << ": idle cpu " << std::fixed
+           << idle_cpu * 100 << "%, wakeup latency avg "
+           << total / latencies.size() / 1000 << "us p50 "
+           << latencies[latencies.size() / 2] / 1000 << "us p99 "
+           << latencies[latencies.size() * 99 / 100] / 1000 << "us";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 3) {
+    LOG_WARN << "Usage: idle_bench threads rounds";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const int rounds = std::max(1, std::atoi(argv[2]));
+
+  Run(threads, rounds, false);
+  Run(threads, rounds, true);
+}
@@ -0,0 +1,130 @@
+// FIFO against the LIFO slot: pairs of services pass a ball back and forth
+// with AsyncCallMethod while busy services keep the ready queues full, the
+// benchmark reports the round trips per second of both scheduling policies.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<int> finished{0};
+std::atomic<bool> stop_busy{false};
+std::atomic<int> busy_finished{0};
+
+class Player : public MethodCallService {
+ public:
+  using MethodCallService::MethodCallService;
+
+  void Ball(BasicHandle<Player> peer, int left) {
+    if (left == 0) {
+      ++finished;
+      return;
+    }
+    system()->AsyncCallMethod(peer, &Player::Ball, BasicHandle<Player>(handle()), left - 1);
+  }
+};
+
+class Busy : public UserThreadService {
+ public:
+  using UserThreadService::UserThreadService;
+
+  void Main() override {
+    while (!stop_busy.load(std::memory_order_relaxed)) {
+      auto const until = std::chrono::steady_clock::now() + std::chrono::microseconds(50);
+      while (std::chrono::steady_clock::now() < until) {
+      }
+      Yield();
+    }
+    ++busy_finished;
+  }
+};
+
+// returns the round trips per second, 0 on failure
+double Run(int threads, int pairs, int rounds, int busy, SchedulingPolicy policy) {
+  finished = 0;
+  stop_busy = false;
+  busy_finished = 0;
+
+  System sys;
+  sys.SetSchedulingPolicy(policy);
+  if (!sys.Start(threads))
+    return 0;
+
+  for (int i = 0; i < busy; ++i) {
+    if (!sys.LaunchService<Busy, System::kSmallStackSize>("Busy")) {
+      LOG_WARN << "LaunchService Busy failed," << i;
+      return 0;
+    }
+  }
+
+  std::vector<std::pair<BasicHandle<Player>, BasicHandle<Player>>> players;
+  for (int i = 0; i < pairs; ++i) {
+    auto ping = sys.LaunchService<Player>("Player");
+    auto pong = sys.LaunchService<Player>("Player");
+    if (!ping || !pong) {
+      LOG_WARN << "LaunchService Player failed," << i;
+      return 0;
+    }
+    players.emplace_back(ping, pong);
+  }
+
+  this_thread::SleepFor(std::chrono::milliseconds(100));
+  Timer timer;
+  timer.Start();
+  for (auto& p : players) {
+    sys.AsyncCallMethod(p.first, &Player::Ball, p.second, rounds * 2);
+  }
+  while (finished.load() != pairs) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const double secs = timer.Elapsed().ToSeconds();
+
+  stop_busy = true;
+  while (busy_finished.load() != busy) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  sys.Stop();
+
+  return static_cast<double>(pairs) * rounds / secs;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 5) {
+    LOG_WARN << "Usage: policy_bench threads pairs rounds busy";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const int pairs = std::atoi(argv[2]);
+  const int rounds = std::atoi(argv[3]);
+  const int busy = std::atoi(argv[4]);
+  if (pairs <= 0 || rounds <= 0 || busy < 0) {
+    LOG_WARN << "policy_bench: require pairs > 0, rounds > 0 and busy >= 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running scheduling policy benchmark: threads " << threads << " pairs "
+           << pairs << " rounds " << rounds << " busy " << busy;
+
+  const double fifo = Run(threads, pairs, rounds, busy, SchedulingPolicy::kFifo);
+  const double lifo = Run(threads, pairs, rounds, busy, SchedulingPolicy::kLifoSlot);
+  LOG_INFO << std::fixed << "fifo: " << fifo << " round trips/s";
+  LOG_INFO << std::fixed << "lifo slot: " << lifo << " round trips/s";
+}
@@ -0,0 +1,112 @@
+// Ring of actors: every RingActor forwards the tokens it receives to its
+// successor with AsyncCallMethod, the benchmark reports the number of
+// messages handled per second.
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+struct alignas(kCacheLineSize) HopCounter {
+  std::atomic<uint64_t> hops{0};
+};
+
+class RingActor : public MethodCallService {
+ public:
+  RingActor(System* sys, const std::string& name, HopCounter* counter)
+      : MethodCallService(sys, name), counter_(counter) {}
+
+  void SetNext(BasicHandle<RingActor> next) {
+    next_ = next;
+  }
+
+  void Pass() {
+    // only this actor writes its counter
+    counter_->hops.store(counter_->hops.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    system()->AsyncCallMethod(next_, &RingActor::Pass);
+  }
+
+ private:
+  HopCounter* counter_;
+  BasicHandle<RingActor> next_;
+};
+
+uint64_t TotalHops(const std::vector<HopCounter>& counters) {
+  uint64_t total = 0;
+  for (auto& c : counters) {
+    total += c.hops.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 5) {
+    LOG_WARN << "Usage: ring_bench threads actors tokens seconds";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const int actors = std::atoi(argv[2]);
+  const int tokens = std::atoi(argv[3]);
+  const int seconds = std::atoi(argv[4]);
+  if (actors <= 0 || tokens <= 0 || tokens > actors) {
+    LOG_WARN << "ring_bench: require 0 < tokens <= actors";
+    return -1;
+  }
+
+  LOG_INFO << "Running ring benchmark: threads " << threads << " actors " << actors
+           << " tokens " << tokens << " seconds " << seconds;
+
+  System sys;
+  sys.Start(threads);
+
+  std::vector<HopCounter> counters(static_cast<size_t>(actors));
+  std::vector<System::BasicHandle<RingActor>> ring;
+  for (int i = 0; i < actors; ++i) {
+    auto h = sys.LaunchService<RingActor, System::kSmallStackSize>(
+        "RingActor", &counters[static_cast<size_t>(i)]);
+    if (!h) {
+      LOG_WARN << "LaunchService RingActor failed," << i;
+      return -1;
+    }
+    ring.push_back(h);
+  }
+
+  for (size_t i = 0; i < ring.size(); ++i) {
+    sys.CallMethod(ring[i], &RingActor::SetNext, ring[(i + 1) % ring.size()]);
+  }
+
+  for (int i = 0; i < tokens; ++i) {
+    sys.AsyncCallMethod(ring[static_cast<size_t>(i * (actors / tokens))], &RingActor::Pass);
+  }
+
+  this_thread::SleepFor(std::chrono::seconds(1));  // warm up
+  const uint64_t start_hops = TotalHops(counters);
+  Timer timer;
+  timer.Start();
+
+  this_thread::SleepFor(std::chrono::seconds(seconds));
+  const double secs = timer.Elapsed().ToSeconds();
+  const uint64_t hops = TotalHops(counters) - start_hops;
+  sys.Stop();
+
+  LOG_INFO << hops << " messages in " << secs << " seconds";
+  LOG_INFO << std::fixed << static_cast<double>(hops) / secs << " messages/s";
+}
@@ -0,0 +1,123 @@
+// Shared queues against thread-per-core shards: every Caller service calls its
+// own Callee with CallMethod in a loop, first on the shared-queue scheduler,
+// then on a sharded System where each callee lives on the shard next to its
+// caller's, so every call crosses shards through the SPSC rings. The benchmark
+// reports the calls per second of both.
+
+#include <atomic>
+#include <cstdlib>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<int> finished{0};
+std::atomic<bool> go{false};
+
+class Callee : public MethodCallService {
+ public:
+  using MethodCallService::MethodCallService;
+
+  void Ping(int n, int* res) {
+    *res = n + 1;
+  }
+};
+
+class Caller : public UserThreadService {
+ public:
+  Caller(System* sys, const std::string& name, BasicHandle<Callee> callee, int calls)
+      : UserThreadService(sys, name), callee_(callee), calls_(calls) {}
+
+  void Main() override {
+    while (!go.load(std::memory_order_acquire)) {
+      Sleep(10);
+    }
+
+    int res = 0;
+    for (int i = 0; i < calls_; ++i) {
+      if (!system()->CallMethod(callee_, &Callee::Ping, i, &res) || res != i + 1) {
+        LOG_WARN << "shard_bench: CallMethod failed";
+        break;
+      }
+    }
+    ++finished;
+  }
+
+ private:
+  BasicHandle<Callee> callee_;
+  int calls_;
+};
+
+// returns the calls per second, 0 on failure
+double Run(int threads, int pairs, int calls, bool sharded) {
+  finished = 0;
+  go = false;
+
+  StartOptions options;
+  options.worker_num = threads;
+  options.sharded = sharded;
+
+  System sys;
+  if (!sys.Start(options))
+    return 0;
+
+  for (int i = 0; i < pairs; ++i) {
+    ServiceOptions callee_options;
+    ServiceOptions caller_options;
+    callee_options.shard = i + 1;
+    caller_options.shard = i;
+    auto callee = sys.LaunchServiceWithOptions<Callee>(callee_options, "Callee");
+    if (!callee || !sys.LaunchServiceWithOptions<Caller, System::kSmallStackSize>(
+                       caller_options, "Caller", callee, calls)) {
+      LOG_WARN << "LaunchService failed," << i;
+      return 0;
+    }
+  }
+
+  this_thread::SleepFor(std::chrono::milliseconds(100));
+  Timer timer;
+  timer.Start();
+  go.store(true, std::memory_order_release);
+  while (finished.load() != pairs) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const double secs = timer.Elapsed().ToSeconds();
+  sys.Stop();
+
+  return static_cast<double>(pairs) * calls / secs;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 4) {
+    LOG_WARN << "Usage: shard_bench threads pairs calls";
+    return -1;
+  }
+
+  const int threads = std::atoi(argv[1]);
+  const int pairs = std::atoi(argv[2]);
+  const int calls = std::atoi(argv[3]);
+  if (pairs <= 0 || calls <= 0) {
+    LOG_WARN << "shard_bench: require pairs > 0 and calls > 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running shard benchmark: threads " << threads << " pairs " << pairs
+           << " calls " << calls;
+
+  const double shared = Run(threads, pairs, calls, false);
+  const double sharded = Run(threads, pairs, calls, true);
+  LOG_INFO << std::fixed << "shared queues: " << shared << " calls/s";
+  LOG_INFO << std::fixed << "sharded: " << sharded << " calls/s";
+}
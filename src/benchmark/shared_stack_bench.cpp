@@ -0,0 +1,165 @@
+// Shared stacks against dedicated ones. First, idle services, each of which
+// used 2KB of its stack before blocking in WaitSignal like a connection
+// waiting for input, the benchmark reports the memory (RSS) per service.
+// Then pairs of services pass a ball back and forth with AsyncCallMethod on
+// one worker, so every pass switches between two services, the benchmark
+// reports the time of a pass.
+
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<int> blocked{0};
+std::atomic<int> finished{0};
+
+class Idler : public UserThreadService {
+ public:
+  using UserThreadService::UserThreadService;
+
+  void Main() override {
+    char frame[2048];
+    memset(frame, 1, sizeof frame);
+    ++blocked;
+    WaitSignal();
+    if (frame[sizeof frame - 1] != 1)
+      LOG_WARN << "shared_stack_bench: stack corrupted";
+  }
+};
+
+class Player : public MethodCallService {
+ public:
+  using MethodCallService::MethodCallService;
+
+  void Ball(BasicHandle<Player> peer, int left) {
+    if (left == 0) {
+      ++finished;
+      return;
+    }
+    system()->AsyncCallMethod(peer, &Player::Ball, BasicHandle<Player>(handle()), left - 1);
+  }
+};
+
+uint64_t Rss() {
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  int const n = fscanf(f, "%lu %lu", &size, &resident);
+  fclose(f);
+  return n == 2 ? resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+StartOptions OneShard() {
+  StartOptions options;
+  options.worker_num = 1;
+  options.sharded = true;
+  return options;
+}
+
+// returns the RSS bytes per idle service, 0 on failure
+double IdleMemory(int services, bool shared) {
+  blocked = 0;
+  System sys;
+  if (!sys.Start(OneShard()))
+    return 0;
+
+  ServiceOptions options;
+  options.shared_stack = shared;
+  uint64_t const before = Rss();
+  for (int i = 0; i < services; ++i) {
+    if (!sys.LaunchServiceWithOptions<Idler>(options, "Idler")) {
+      LOG_WARN << "LaunchService Idler failed," << i;
+      return 0;
+    }
+  }
+  while (blocked.load() != services) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  uint64_t const after = Rss();
+  sys.Stop();
+
+  return static_cast<double>(after - before) / services;
+}
+
+// returns the nanoseconds per pass, 0 on failure
+double PassTime(int pairs, int rounds, bool shared) {
+  finished = 0;
+  System sys;
+  if (!sys.Start(OneShard()))
+    return 0;
+
+  ServiceOptions options;
+  options.shared_stack = shared;
+  std::vector<std::pair<BasicHandle<Player>, BasicHandle<Player>>> players;
+  for (int i = 0; i < pairs; ++i) {
+    auto ping = sys.LaunchServiceWithOptions<Player>(options, "Player");
+    auto pong = sys.LaunchServiceWithOptions<Player>(options, "Player");
+    if (!ping || !pong) {
+      LOG_WARN << "LaunchService Player failed," << i;
+      return 0;
+    }
+    players.emplace_back(ping, pong);
+  }
+
+  Timer timer;
+  timer.Start();
+  for (auto& p : players) {
+    sys.AsyncCallMethod(p.first, &Player::Ball, p.second, rounds);
+  }
+  while (finished.load() != pairs) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const double secs = timer.Elapsed().ToSeconds();
+  sys.Stop();
+
+  return secs * 1e9 / (static_cast<double>(pairs) * rounds);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 4) {
+    LOG_WARN << "Usage: shared_stack_bench services pairs rounds";
+    return -1;
+  }
+
+  const int services = std::atoi(argv[1]);
+  const int pairs = std::atoi(argv[2]);
+  const int rounds = std::atoi(argv[3]);
+  if (services <= 0 || pairs <= 0 || rounds <= 0) {
+    LOG_WARN << "shared_stack_bench: require services > 0, pairs > 0 and rounds > 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running shared stack benchmark: services " << services << " pairs " << pairs
+           << " rounds " << rounds;
+
+  const double dedicated_memory = IdleMemory(services, false);
+  const double shared_memory = IdleMemory(services, true);
+  const double dedicated_pass = PassTime(pairs, rounds, false);
+  const double shared_pass = PassTime(pairs, rounds, true);
+  LOG_INFO << std::fixed << "dedicated stacks: " << dedicated_memory << " bytes/service, "
+           << dedicated_pass << " ns/pass";
+  LOG_INFO << std::fixed << "shared stack: " << shared_memory << " bytes/service, "
+           << shared_pass << " ns/pass";
+}
@@ -0,0 +1,138 @@
+// Stackless services against services with a stack of their own. First, idle
+// MethodCallServices waiting for their first message, the benchmark reports
+// the memory (RSS) per service. Then pairs of services pass a ball back and
+// forth with AsyncCallMethod on one worker, the benchmark reports the time of
+// a pass, a context switch for the services with a stack and a function call
+// on the scheduler's stack for the stackless ones.
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<int> finished{0};
+
+class Player : public MethodCallService {
+ public:
+  using MethodCallService::MethodCallService;
+
+  void Ball(BasicHandle<Player> peer, int left) {
+    if (left == 0) {
+      ++finished;
+      return;
+    }
+    system()->AsyncCallMethod(peer, &Player::Ball, BasicHandle<Player>(handle()), left - 1);
+  }
+};
+
+uint64_t Rss() {
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  int const n = fscanf(f, "%lu %lu", &size, &resident);
+  fclose(f);
+  return n == 2 ? resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+// returns the RSS bytes per idle service, 0 on failure
+double IdleMemory(int services, bool stackless) {
+  System sys;
+  if (!sys.Start(1))
+    return 0;
+
+  ServiceOptions options;
+  options.stackless = stackless;
+  uint64_t const before = Rss();
+  for (int i = 0; i < services; ++i) {
+    if (!sys.LaunchServiceWithOptions<Player>(options, "Player")) {
+      LOG_WARN << "LaunchService Player failed," << i;
+      return 0;
+    }
+  }
+  uint64_t const after = Rss();
+  sys.Stop();
+
+  return static_cast<double>(after - before) / services;
+}
+
+// returns the nanoseconds per pass, 0 on failure
+double PassTime(int pairs, int rounds, bool stackless) {
+  finished = 0;
+  System sys;
+  if (!sys.Start(1))
+    return 0;
+
+  ServiceOptions options;
+  options.stackless = stackless;
+  std::vector<std::pair<BasicHandle<Player>, BasicHandle<Player>>> players;
+  for (int i = 0; i < pairs; ++i) {
+    auto ping = sys.LaunchServiceWithOptions<Player>(options, "Player");
+    auto pong = sys.LaunchServiceWithOptions<Player>(options, "Player");
+    if (!ping || !pong) {
+      LOG_WARN << "LaunchService Player failed," << i;
+      return 0;
+    }
+    players.emplace_back(ping, pong);
+  }
+
+  Timer timer;
+  timer.Start();
+  for (auto& p : players) {
+    sys.AsyncCallMethod(p.first, &Player::Ball, p.second, rounds);
+  }
+  while (finished.load() != pairs) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const double secs = timer.Elapsed().ToSeconds();
+  sys.Stop();
+
+  return secs * 1e9 / (static_cast<double>(pairs) * rounds);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 4) {
+    LOG_WARN << "Usage: stackless_bench services pairs rounds";
+    return -1;
+  }
+
+  const int services = std::atoi(argv[1]);
+  const int pairs = std::atoi(argv[2]);
+  const int rounds = std::atoi(argv[3]);
+  if (services <= 0 || pairs <= 0 || rounds <= 0) {
+    LOG_WARN << "stackless_bench: require services > 0, pairs > 0 and rounds > 0";
+    return -1;
+  }
+
+  LOG_INFO << "Running stackless benchmark: services " << services << " pairs " << pairs
+           << " rounds " << rounds;
+
+  const double stack_memory = IdleMemory(services, false);
+  const double stackless_memory = IdleMemory(services, true);
+  const double stack_pass = PassTime(pairs, rounds, false);
+  const double stackless_pass = PassTime(pairs, rounds, true);
+  LOG_INFO << std::fixed << "with stacks: " << stack_memory << " bytes/service, "
+           << stack_pass << " ns/pass";
+  LOG_INFO << std::fixed << "stackless: " << stackless_memory << " bytes/service, "
+           << stackless_pass << " ns/pass";
+}
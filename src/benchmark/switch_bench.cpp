@@ -0,0 +1,89 @@
+// Context switch cost: services on a single worker yield to each other in a
+// loop, the benchmark reports the time of one switch.
+
+#include <atomic>
+#include <cstdlib>
+
+#include "google/protobuf/message.h"
+
+#include "Service.h"
+#include "System.h"
+#include "util/Logging.h"
+#include "util/Thread.h"
+#include "util/Timer.h"
+
+using namespace mcast;
+
+namespace {
+
+std::atomic<int> started{0};
+std::atomic<int> finished{0};
+std::atomic<bool> go{false};
+
+class Yielder : public UserThreadService {
+ public:
+  Yielder(System* sys, const std::string& name, int yields)
+      : UserThreadService(sys, name), yields_(yields) {}
+
+  void Main() override {
+    ++started;
+    while (!go.load(std::memory_order_acquire)) {
+      Yield();
+    }
+
+    for (int i = 0; i < yields_; ++i) {
+      Yield();
+    }
+    ++finished;
+  }
+
+ private:
+  int yields_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc != 3) {
+    LOG_WARN << "Usage: switch_bench services yields";
+    return -1;
+  }
+
+  const int services = std::atoi(argv[1]);
+  const int yields = std::atoi(argv[2]);
+  if (services < 2 || yields <= 0) {
+    LOG_WARN << "switch_bench: require services >= 2 and yields > 0";
+    return -1;
+  }
+
+  System sys;
+  sys.Start(1);
+
+  for (int i = 0; i < services; ++i) {
+    if (!sys.LaunchService<Yielder, System::kSmallStackSize>("Yielder", yields)) {
+      LOG_WARN << "LaunchService Yielder failed," << i;
+      return -1;
+    }
+  }
+
+  while (started.load() != services) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+
+  Timer timer;
+  timer.Start();
+  go.store(true, std::memory_order_release);
+  while (finished.load() != services) {
+    this_thread::SleepFor(std::chrono::milliseconds(1));
+  }
+  const auto elapsed = timer.Elapsed();
+  sys.Stop();
+
+  const double switches = static_cast<double>(services) * yields;
+  LOG_INFO << services << " services, " << yields << " yields each in "
+           << elapsed.ToSeconds() << " seconds";
+  LOG_INFO << std::fixed << static_cast<double>(elapsed.ToNonoseconds()) / switches
+           << " ns per switch";
+}
@@ -25,6 +25,7 @@ int seconds = 10;
 std::atomic<size_t> bytes_written{0};
 std::atomic<size_t> bytes_read{0};
 std::atomic<size_t> num_connected{0};
+std::atomic<uint64_t> migrations{0};
 }
 
 class ClientService : public UserThreadService {
@@ -57,15 +58,19 @@ class ClientService : public UserThreadService {
 
     bytes_written += local_bytes_written;
     bytes_read += local_bytes_read;
+
+    ServiceStats stats;
+    system()->GetServiceStats(this, &stats);
+    migrations += stats.migrations;
   }
 };
 
 int main(int argc, char* argv[]) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
 
-  if (argc != 7) {
+  if (argc != 7 && argc != 8) {
     LOG_WARN << "Usage: pingpong_cli host_ip port threads blocksize "
-                "sessions time";
+                "sessions time [affinity(0|1)]";
     return -1;
   }
 
@@ -75,6 +80,7 @@ int main(int argc, char* argv[]) {
   blocksize = std::atoi(argv[4]);
   sessions = std::atoi(argv[5]);
   seconds = std::atoi(argv[6]);
+  const bool affinity = argc == 8 ? std::atoi(argv[7]) != 0 : true;
 
   for (int i = 0; i < blocksize; ++i) {
     msg.push_back(static_cast<char>(i % 128));
@@ -84,6 +90,7 @@ int main(int argc, char* argv[]) {
            << " sessions " << sessions << " seconds " << seconds;
 
   System sys;
+  sys.SetServiceAffinity(affinity);
   sys.Start(threads);
 
   Timer timer;
@@ -104,6 +111,7 @@ int main(int argc, char* argv[]) {
   LOG_INFO << num_connected.load() << " connections connected";
   LOG_INFO << bytes_written.load() << " bytes written";
   LOG_INFO << bytes_read.load() << " bytes read";
+  LOG_INFO << migrations.load() << " service migrations";
   LOG_INFO << std::fixed << static_cast<double>(bytes_read.load()) / (seds * M)
            << " MiB/s";
 }
@@ -1,3 +1,4 @@
+#include <atomic>
 #include <cstdlib>
 
 #include <signal.h>
@@ -16,6 +17,7 @@ using namespace mcast;
 
 static System sys;
 static TcpServer tcp_server;
+static std::atomic<uint64_t> migrations{0};
 
 static void QuitHandler(int signo) {
   tcp_server.Stop();
@@ -25,16 +27,18 @@ static void QuitHandler(int signo) {
 int main(int argc, char* argv[]) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
 
-  if (argc != 3) {
-    LOG_WARN << "Usage: pingpong_srv port threads";
+  if (argc != 3 && argc != 4) {
+    LOG_WARN << "Usage: pingpong_srv port threads [affinity(0|1)]";
     return -1;
   }
 
   uint16_t port = static_cast<uint16_t>(atoi(argv[1]));
   int threads = atoi(argv[2]);
+  const bool affinity = argc == 4 ? atoi(argv[3]) != 0 : true;
 
   LOG_INFO << "pingpong server start port " << port << ",threads " << threads;
 
+  sys.SetServiceAffinity(affinity);
   sys.Start(threads);
   tcp_server.SetOnNewConnection([](TcpConnection* conn) {
     return [conn]() mutable {
@@ -44,13 +48,17 @@ int main(int argc, char* argv[]) {
         if (s) {
           if (!conn->Write(buf, s.get())) {
             // LOG_WARN << "Write error:" << s.satus().ErrorString();
-            return;
+            break;
           }
         } else {
           // LOG_WARN << "ReadSome error:" << s.status().ErrorString();
-          return;
+          break;
         }
       }
+
+      ServiceStats stats;
+      sys.GetServiceStats(conn->service(), &stats);
+      migrations += stats.migrations;
     };
   });
 
@@ -59,7 +67,7 @@ int main(int argc, char* argv[]) {
   signal(SIGTERM, QuitHandler);
 
   sys.WaitStop();
-  LOG_INFO << "pingpong server stop";
+  LOG_INFO << "pingpong server stop, " << migrations.load() << " service migrations";
   tcp_server.Stop();
   sys.Stop();
 }
@@ -0,0 +1,37 @@
+#ifndef CAST_FUTEX_H_
+#define CAST_FUTEX_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+namespace mcast {
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex word must be an int");
+
+// blocks while *addr == expected, returns on wake up, signal or timeout
+inline void FutexWait(std::atomic<int>* addr, int expected,
+                      const struct timespec* timeout = nullptr) {
+  syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT_PRIVATE, expected,
+          timeout, nullptr, 0);
+}
+
+inline void FutexWake(std::atomic<int>* addr, int n) {
+  syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAKE_PRIVATE, n, nullptr,
+          nullptr, 0);
+}
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause" ::: "memory");
+#else
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+}  // namespace mcast
+
+#endif  // CAST_FUTEX_H_
@@ -0,0 +1,160 @@
+#ifndef CAST_INTRUSIVEPTR_H_
+#define CAST_INTRUSIVEPTR_H_
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace mcast {
+
+// IntrusivePtr is a smart pointer to an object embedding its own reference
+// count, unlike std::shared_ptr there is no separate control block. T must
+// provide, found by argument dependent lookup:
+//   void IntrusivePtrAddRef(T*);
+//   void IntrusivePtrRelease(T*);  // deletes the object on the last release
+//   long IntrusivePtrUseCount(const T*);
+template <typename T>
+class IntrusivePtr {
+  template <typename U>
+  friend class IntrusivePtr;
+
+ public:
+  typedef T element_type;
+
+  IntrusivePtr() noexcept = default;
+  IntrusivePtr(std::nullptr_t) noexcept {}
+
+  explicit IntrusivePtr(T* p, bool add_ref = true) : ptr_(p) {
+    if (ptr_ && add_ref)
+      IntrusivePtrAddRef(ptr_);
+  }
+
+  IntrusivePtr(const IntrusivePtr& other) : ptr_(other.ptr_) {
+    if (ptr_)
+      IntrusivePtrAddRef(ptr_);
+  }
+
+  IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(other.ptr_) {
+    other.ptr_ = nullptr;
+  }
+
+  template <typename U>
+  IntrusivePtr(const IntrusivePtr<U>& other) : ptr_(other.ptr_) {
+    if (ptr_)
+      IntrusivePtrAddRef(ptr_);
+  }
+
+  template <typename U>
+  IntrusivePtr(IntrusivePtr<U>&& other) noexcept : ptr_(other.ptr_) {
+    other.ptr_ = nullptr;
+  }
+
+  ~IntrusivePtr() {
+    if (ptr_)
+      IntrusivePtrRelease(ptr_);
+  }
+
+  IntrusivePtr& operator=(const IntrusivePtr& other) {
+    IntrusivePtr(other).swap(*this);
+    return *this;
+  }
+
+  IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
+    IntrusivePtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  template <typename U>
+  IntrusivePtr& operator=(const IntrusivePtr<U>& other) {
+    IntrusivePtr(other).swap(*this);
+    return *this;
+  }
+
+  template <typename U>
+  IntrusivePtr& operator=(IntrusivePtr<U>&& other) noexcept {
+    IntrusivePtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  void reset() noexcept {
+    IntrusivePtr().swap(*this);
+  }
+
+  void reset(T* p) {
+    IntrusivePtr(p).swap(*this);
+  }
+
+  // gives up the ownership without releasing the reference
+  T* detach() noexcept {
+    T* p = ptr_;
+    ptr_ = nullptr;
+    return p;
+  }
+
+  void swap(IntrusivePtr& other) noexcept {
+    std::swap(ptr_, other.ptr_);
+  }
+
+  T* get() const noexcept {
+    return ptr_;
+  }
+
+  T& operator*() const noexcept {
+    return *ptr_;
+  }
+
+  T* operator->() const noexcept {
+    return ptr_;
+  }
+
+  explicit operator bool() const noexcept {
+    return ptr_ != nullptr;
+  }
+
+  long use_count() const {
+    return ptr_ ? IntrusivePtrUseCount(ptr_) : 0;
+  }
+
+ private:
+  T* ptr_ = nullptr;
+};
+
+template <typename T, typename U>
+inline bool operator==(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) noexcept {
+  return a.get() == b.get();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) noexcept {
+  return a.get() != b.get();
+}
+
+template <typename T>
+inline bool operator==(const IntrusivePtr<T>& a, std::nullptr_t) noexcept {
+  return !a;
+}
+
+template <typename T>
+inline bool operator!=(const IntrusivePtr<T>& a, std::nullptr_t) noexcept {
+  return static_cast<bool>(a);
+}
+
+template <typename T, typename... Args>
+inline IntrusivePtr<T> MakeIntrusive(Args&&... args) {
+  return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+}  // namespace mcast
+
+namespace std {
+
+template <typename T>
+struct hash<mcast::IntrusivePtr<T>> {
+  size_t operator()(const mcast::IntrusivePtr<T>& p) const noexcept {
+    return hash<T*>()(p.get());
+  }
+};
+
+}  // namespace std
+
+#endif  // CAST_INTRUSIVEPTR_H_
@@ -125,6 +125,11 @@ class Logger {
   const char *line_;
 };
 
+// turns a stream expression into void, for the conditional LOG_TRACE
+struct LogVoidify {
+  void operator&(std::ostream &) {}
+};
+
 inline Logger::Printer SetLogPrinter(Logger::Printer p) {
   auto oldp = Logger::s_printer;
   Logger::s_printer = p;
@@ -160,8 +165,12 @@ inline std::string ErrnoText() {
         << "errno : " << strerror_r(errno, buf, sizeof buf);             \
   }
 
-#define LOG_TRACE \
-  mcast::Logger(mcast::LogLevel::kTrace, __FILE__, LINE_STR(__LINE__)).stream()
+// the message is not even formatted while trace logging is off
+#define LOG_TRACE                                  \
+  mcast::Logger::s_level > mcast::LogLevel::kTrace \
+      ? (void)0                                    \
+      : mcast::LogVoidify() &                      \
+            mcast::Logger(mcast::LogLevel::kTrace, __FILE__, LINE_STR(__LINE__)).stream()
 
 #define LOG_INFO \
   mcast::Logger(mcast::LogLevel::kInfo, __FILE__, LINE_STR(__LINE__)).stream()
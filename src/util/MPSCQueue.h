@@ -83,6 +83,64 @@ class MPSCQueue : public Noncopyable {
   alignas(kCacheLineSize) Node* head_;
   std::atomic<size_t> size_{0};
 };
+
+// IntrusiveMPSCQueue links the nodes through their own next field instead of
+// copying the values, Node must have a std::atomic<Node*> next member.
+// Push is wait-free, Pop may return nullptr while a Push is in progress.
+template <typename Node>
+class IntrusiveMPSCQueue : public Noncopyable {
+ public:
+  IntrusiveMPSCQueue() : tail_(&stub_), head_(&stub_) {}
+
+  void Push(Node* node) noexcept {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = tail_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  Node* Pop() noexcept {
+    Node* head = head_;
+    Node* next = head->next.load(std::memory_order_acquire);
+    if (head == &stub_) {
+      if (nullptr == next)
+        return nullptr;
+
+      head_ = next;
+      head = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+      head_ = next;
+      return head;
+    }
+
+    if (tail_.load(std::memory_order_acquire) != head)
+      return nullptr;  // a push is in progress
+
+    Push(&stub_);
+    next = head->next.load(std::memory_order_acquire);
+    if (next) {
+      head_ = next;
+      return head;
+    }
+
+    return nullptr;
+  }
+
+  // called by the consumer, false while a push is in progress
+  bool Empty() const noexcept {
+    return tail_.load(std::memory_order_acquire) == &stub_;
+  }
+
+ private:
+  std::atomic<Node*> tail_;
+  // keeps the producers' tail_ and the consumer's head_ on different cache
+  // lines without over-aligning the queue
+  char pad_[kCacheLineSize - sizeof(std::atomic<Node*>)];
+  Node* head_;
+  Node stub_;
+};
 }  // namespace waitfree
 }  // namespace concurrence
 }  // namespace mcast
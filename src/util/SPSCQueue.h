@@ -0,0 +1,88 @@
+#ifndef CAST_SPSCQUEUE_H_
+#define CAST_SPSCQUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "Noncopyable.h"
+#include "util_config.h"
+
+namespace mcast {
+namespace concurrence {
+namespace waitfree {
+
+// SPSCRing is a bounded queue between one producer and one consumer thread.
+// Both sides are wait-free, each keeps a cached copy of the other's index so
+// the shared cache lines are only read when the ring looks empty or full.
+template <typename T>
+class SPSCRing : public Noncopyable {
+ public:
+  // the capacity is rounded up to a power of 2
+  explicit SPSCRing(size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    slots_.reset(new T[n]);
+    mask_ = n - 1;
+  }
+
+  // producer side, returns false and leaves x alone if the ring is full
+  bool Push(T&& x) {
+    size_t const tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_)
+        return false;
+    }
+
+    slots_[tail & mask_] = std::move(x);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side
+  bool Pop(T* x) {
+    size_t const head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_)
+        return false;
+    }
+
+    *x = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // may be called by any thread, the result may be stale
+  bool Empty() const {
+    return head_.load(std::memory_order_seq_cst) == tail_.load(std::memory_order_seq_cst);
+  }
+
+  size_t Capacity() const {
+    return mask_ + 1;
+  }
+
+ private:
+  std::unique_ptr<T[]> slots_;
+  size_t mask_ = 0;
+
+  // the consumer's and the producer's fields on different cache lines
+  // without over-aligning the ring
+  char pad0_[kCacheLineSize];
+  std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  char pad1_[kCacheLineSize - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+};
+
+}  // namespace waitfree
+}  // namespace concurrence
+}  // namespace mcast
+
+#endif  // CAST_SPSCQUEUE_H_
@@ -0,0 +1,51 @@
+#include "SPSCQueue.h"
+
+#include <thread>
+
+#include "Test.h"
+
+using namespace mcast::concurrence::waitfree;
+
+TEST(SPSCQueueTest, PushPopTestCase) {
+  SPSCRing<int> ring(3);
+  ASSERT_EQ(ring.Capacity(), 4U);
+  ASSERT_TRUE(ring.Empty());
+
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(ring.Push(int(i)));
+  }
+  int x = 4;
+  ASSERT_FALSE(ring.Push(std::move(x)));
+  ASSERT_FALSE(ring.Empty());
+
+  for (int i = 0; i < 4; ++i) {
+    int y = -1;
+    ASSERT_TRUE(ring.Pop(&y));
+    ASSERT_EQ(y, i);
+  }
+  int y = -1;
+  ASSERT_FALSE(ring.Pop(&y));
+  ASSERT_TRUE(ring.Empty());
+}
+
+TEST(SPSCQueueTest, ThreadsTestCase) {
+  SPSCRing<int> ring(64);
+  const int n = 100000;
+  std::thread producer([&ring]() {
+    for (int i = 0; i < n; ++i) {
+      while (!ring.Push(int(i))) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  for (int i = 0; i < n; ++i) {
+    int x = -1;
+    while (!ring.Pop(&x)) {
+      std::this_thread::yield();
+    }
+    ASSERT_EQ(x, i);
+  }
+  producer.join();
+  ASSERT_TRUE(ring.Empty());
+}
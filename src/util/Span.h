@@ -0,0 +1,56 @@
+#ifndef CAST_SPAN_H_
+#define CAST_SPAN_H_
+
+#include <stddef.h>
+
+#include <cassert>
+
+namespace mcast {
+
+// Span is a non-owning view of contiguous objects, a small subset of
+// std::span which is not available in C++14.
+template <typename T>
+class Span {
+ public:
+  typedef T value_type;
+  typedef T* iterator;
+
+  Span() = default;
+  Span(T* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename Container>
+  Span(Container& c) : data_(c.data()), size_(c.size()) {}
+
+  T* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  T& operator[](size_t i) const {
+    assert(i < size_);
+    return data_[i];
+  }
+
+  iterator begin() const {
+    return data_;
+  }
+
+  iterator end() const {
+    return data_ + size_;
+  }
+
+ private:
+  T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace mcast
+
+#endif  // CAST_SPAN_H_
@@ -1,9 +1,41 @@
 #include "Thread.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 namespace mcast {
 
 thread_local ThreadImpl* Thread::s_self{nullptr};
 
 thread_local AtThreadExitCaller Thread::s_at_thread_exit;
 
+namespace this_thread {
+
+bool SetAffinity(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+
+  if (CPU_COUNT(&set) == 0)
+    return false;
+
+  return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+}
+
+int NumaNode() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    return 0;
+
+  return static_cast<int>(node);
+}
+
+}  // namespace this_thread
+
 }  // namespace mcast
\ No newline at end of file
@@ -194,6 +194,12 @@ inline bool IsInterrupted() {
   return Thread::s_self->IsInterrupted();
 }
 
+// pins the calling thread to cpus, returns false if none of them is usable
+bool SetAffinity(const std::vector<int>& cpus);
+
+// the NUMA node of the cpu the calling thread is running on, 0 if unknown
+int NumaNode();
+
 inline void Interrupt() {
   assert(Thread::s_self);
   return Thread::s_self->Interrupt();
@@ -5,6 +5,7 @@
 #include <list>
 #include <mutex>
 #include <atomic>
+#include <vector>
 
 #include "Noncopyable.h"
 #include "util_config.h"
@@ -82,6 +83,18 @@ class alignas(kCacheLineSize) ThreadSafeQueue : Noncopyable {
     return true;
   }
 
+  // pops the older half (rounded up) of the elements into *out, used by
+  // work stealing
+  size_type popHalf(std::vector<T> *out) {
+    std::lock_guard<std::mutex> lg(mutex_);
+    size_type const n = (queue_.size() + 1) / 2;
+    for (size_type i = 0; i < n; ++i) {
+      out->push_back(std::move(queue_.front()));
+      queue_.pop_front();
+    }
+    return n;
+  }
+
   bool empty() {
     std::lock_guard<std::mutex> lg(mutex_);
     return queue_.empty();
@@ -49,7 +49,7 @@ class Timestamp {
     if (internal::g_invariant_cpu_freq) {
       uint64_t cycles = time_;
       uint64_t sec = cycles / internal::g_invariant_cpu_freq;
-      uint64_t nsec = (cycles - sec * kNonosecondsPerSecond) * kNonosecondsPerSecond /
+      uint64_t nsec = (cycles - sec * internal::g_invariant_cpu_freq) * kNonosecondsPerSecond /
                       internal::g_invariant_cpu_freq;
 
       return sec * kNonosecondsPerSecond + nsec;
@@ -14,4 +14,13 @@ using namespace mcast;
 //   LOG_WARN << t.Elapsed().count();
 //   LOG_WARN << t.Elapsed().ToNonoseconds();
 //   LOG_WARN << std::fixed << std::setprecision(9) << t.Elapsed().ToSeconds();
-// }
\ No newline at end of file
+// }
+TEST(TimerTest, ToNonosecondsTestCase) {
+  // 2.5 seconds in the unit of Now, cycles of the invariant TSC or nanoseconds
+  uint64_t const per_second = internal::g_invariant_cpu_freq
+                                  ? internal::g_invariant_cpu_freq
+                                  : Timestamp::kNonosecondsPerSecond;
+  Timestamp const t(per_second * 5 / 2);
+  ASSERT_NEAR(static_cast<double>(t.ToNonoseconds()), 2.5e9, 1.0);
+  ASSERT_NEAR(t.ToSeconds(), 2.5, 1e-6);
+}